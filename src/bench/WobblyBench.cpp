@@ -0,0 +1,588 @@
+// Times reading, writing, script generation and script evaluation for synthetic projects of various sizes,
+// and checks that their timecodes come out at 23.976 fps.
+// Usage: wobbly-bench [number of frames]...
+//        wobbly-bench --peak-memory wobbly|qjson <project> (used by the benchmark itself)
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QProcess>
+
+#include <VSScript.h>
+
+#include "JsonWriter.h"
+#include "WobblyException.h"
+#include "WobblyProject.h"
+
+
+// Peak resident set size of the whole process, in MiB, or -1 if unknown.
+static double peakMemory() {
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0;
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+
+// Where the benchmark's own executable is, to run it again for the peak memory.
+static std::string bench_path;
+
+
+// The old way to read a project: the whole file, then a QJsonDocument. Only the parsing,
+// so the real cost of the old readProject was somewhat higher.
+static QJsonDocument parseWithQJsonDocument(const std::string &path) {
+    QFile file(QString::fromStdString(path));
+
+    if (!file.open(QIODevice::ReadOnly))
+        throw WobblyException("Couldn't open '" + path + "' for reading.");
+
+    QByteArray data = file.readAll();
+
+    QJsonParseError error;
+    QJsonDocument json = QJsonDocument::fromJson(data, &error);
+    if (json.isNull())
+        throw WobblyException("Couldn't parse '" + path + "': " + error.errorString().toStdString());
+
+    return json;
+}
+
+
+// Reads path once with one of the readers and prints the peak memory.
+static int printReaderPeakMemory(const std::string &reader, const std::string &path) {
+    if (reader == "qjson") {
+        QJsonDocument json = parseWithQJsonDocument(path);
+
+        printf("%f\n", peakMemory());
+    } else {
+        WobblyProject project(true);
+        project.readProject(path);
+
+        printf("%f\n", peakMemory());
+    }
+
+    return 0;
+}
+
+
+// Peak memory of reading path, in MiB, or -1 if unknown. Measured in a new process,
+// because nothing else the benchmark did should count.
+static double readerPeakMemory(const std::string &reader, const std::string &path) {
+    QProcess process;
+    process.start(QString::fromStdString(bench_path), QStringList() << QStringLiteral("--peak-memory") << QString::fromStdString(reader) << QString::fromStdString(path));
+
+    if (!process.waitForFinished(-1) || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+        return -1;
+
+    QByteArray output = process.readAllStandardOutput();
+    if (output.isEmpty())
+        return -1;
+
+    return atof(output.constData());
+}
+
+
+// Roughly what Wibbly writes for a telecined source with occasional pattern changes.
+static void writeWibblyProject(const std::string &path, int num_frames, std::mt19937 &rng) {
+    QFile file(QString::fromStdString(path));
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        throw WobblyException("Couldn't open '" + path + "' for writing.");
+
+    std::uniform_int_distribution<int> mic_distribution(0, 90);
+    std::uniform_int_distribution<int> metric_distribution(0, 20000);
+    std::uniform_int_distribution<int> section_distribution(300, 3000);
+    std::uniform_int_distribution<int> percent_distribution(0, 99);
+    std::uniform_int_distribution<int> offset_distribution(0, 4);
+
+    // The telecine pattern changes at every section.
+    std::vector<int> section_starts;
+    std::vector<int> pattern_offsets;
+    for (int start = 0; start < num_frames; start += section_distribution(rng)) {
+        section_starts.push_back(start);
+        pattern_offsets.push_back(offset_distribution(rng));
+    }
+
+    std::string matches;
+    std::vector<int> decimated_cycles;
+    for (size_t i = 0; i < section_starts.size(); i++) {
+        int end = i + 1 < section_starts.size() ? section_starts[i + 1] : num_frames;
+        for (int frame = section_starts[i]; frame < end; frame++) {
+            matches += "cccnn"[(frame + pattern_offsets[i]) % 5];
+            if (frame % 5 == 0)
+                decimated_cycles.push_back(1 << ((5 - pattern_offsets[i]) % 5));
+        }
+    }
+
+    JsonWriter json(&file);
+
+    json.beginObject();
+
+    json.writeKey("wibbly wobbly version");
+    json.writeInt(PROJECT_FORMAT_VERSION);
+
+    json.writeKey("input file");
+    json.writeString("synthetic.d2v");
+
+    json.writeKey("input frame rate");
+    json.beginArray(true);
+    json.writeInt(30000);
+    json.writeInt(1001);
+    json.endArray();
+
+    json.writeKey("input resolution");
+    json.beginArray(true);
+    json.writeInt(720);
+    json.writeInt(480);
+    json.endArray();
+
+    json.writeKey("trim");
+    json.beginArray();
+    json.beginArray(true);
+    json.writeInt(0);
+    json.writeInt(num_frames - 1);
+    json.endArray();
+    json.endArray();
+
+    json.writeKey("vfm parameters");
+    json.beginObject();
+    json.writeKey("order");
+    json.writeDouble(1);
+    json.endObject();
+
+    json.writeKey("vdecimate parameters");
+    json.beginObject();
+    json.endObject();
+
+    json.writeKey("mics");
+    json.beginArray();
+    for (int i = 0; i < num_frames; i++) {
+        json.beginArray(true);
+        for (int j = 0; j < 5; j++)
+            json.writeInt(mic_distribution(rng));
+        json.endArray();
+    }
+    json.endArray();
+
+    json.writeKey("matches");
+    json.writeString(matches);
+
+    json.writeKey("original matches");
+    json.writeString(matches);
+
+    // About one frame in a hundred, in short runs.
+    json.writeKey("combed ranges");
+    json.beginArray(true);
+    for (int frame = 0; frame < num_frames; frame += 100) {
+        int first = frame + percent_distribution(rng) % 90;
+        int last = std::min(first + offset_distribution(rng) % 3, num_frames - 1);
+        if (first >= num_frames)
+            break;
+        json.beginArray(true);
+        json.writeInt(first);
+        json.writeInt(last);
+        json.endArray();
+    }
+    json.endArray();
+
+    json.writeKey("decimated cycles");
+    json.beginArray(true);
+    for (size_t i = 0; i < decimated_cycles.size(); ) {
+        int mask = decimated_cycles[i];
+        int run = 1;
+        for (i++; i < decimated_cycles.size() && decimated_cycles[i] == mask; i++)
+            run++;
+        json.beginArray(true);
+        json.writeInt(mask);
+        json.writeInt(run);
+        json.endArray();
+    }
+    json.endArray();
+
+    json.writeKey("decimate metrics");
+    json.beginArray(true);
+    for (int i = 0; i < num_frames; i++)
+        json.writeInt(metric_distribution(rng));
+    json.endArray();
+
+    json.writeKey("sections");
+    json.beginArray();
+    for (size_t i = 0; i < section_starts.size(); i++) {
+        json.beginObject();
+        json.writeKey("start");
+        json.writeInt(section_starts[i]);
+        json.writeKey("presets");
+        json.beginArray(true);
+        json.endArray();
+        json.endObject();
+    }
+    json.endArray();
+
+    json.endObject();
+
+    json.flush();
+}
+
+
+// Adds what a user would add in Wobbly: presets, custom lists and freeze frames.
+static void addWobblyEdits(WobblyProject &project, std::mt19937 &rng) {
+    int num_frames = project.num_frames[PostSource];
+
+    std::uniform_int_distribution<int> preset_distribution(0, 4);
+    std::uniform_int_distribution<int> length_distribution(10, 100);
+    std::uniform_int_distribution<int> gap_distribution(500, 3000);
+
+    for (int i = 0; i < 5; i++)
+        project.addPreset("preset" + std::to_string(i), "clip = core.std.Transpose(clip)\nclip = core.std.Transpose(clip)");
+
+    std::vector<int> section_starts;
+    for (auto it = project.sections.cbegin(); it != project.sections.cend(); it++)
+        section_starts.push_back(it->first);
+
+    for (size_t i = 0; i < section_starts.size(); i += 2)
+        project.assignPresetToSection("preset" + std::to_string(preset_distribution(rng)), section_starts[i]);
+
+    for (int i = 0; i < 3; i++) {
+        CustomList list("list" + std::to_string(i), project.getPresetId("preset" + std::to_string(i)), i % 3);
+
+        for (int frame = gap_distribution(rng); frame < num_frames; frame += gap_distribution(rng))
+            list.addFrameRange(frame, std::min(frame + length_distribution(rng), num_frames - 1));
+
+        project.addCustomList(list);
+    }
+
+    for (int frame = gap_distribution(rng); frame + 1 < num_frames; frame += 2 * gap_distribution(rng)) {
+        int last = std::min(frame + length_distribution(rng) / 10, num_frames - 2);
+        project.addFreezeFrame(frame, last, last + 1);
+    }
+}
+
+
+// Clips in the splice that applies the sections' presets. Each one starts with "sectionN = src".
+static int countSectionClips(const std::string &script) {
+    int clips = 0;
+
+    for (size_t pos = script.find("\nsection"); pos != std::string::npos; pos = script.find("\nsection", pos + 1)) {
+        size_t end = script.find_first_not_of("0123456789", pos + 8);
+
+        if (end != pos + 8 && script.compare(end, 6, " = src") == 0 && (script[end + 6] == '[' || script[end + 6] == '\n'))
+            clips++;
+    }
+
+    return clips;
+}
+
+
+// Lowest and highest frame rate between consecutive lines of a v2 timecodes file.
+static void timecodesFrameRates(const std::string &path, double &lowest, double &highest) {
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly))
+        throw WobblyException("Couldn't open timecodes file '" + path + "'. Error message: " + file.errorString().toStdString());
+
+    QByteArray contents = file.readAll();
+    contents.append('\0');
+
+    lowest = highest = 0;
+
+    double previous = -1;
+    int intervals = 0;
+
+    for (const char *line = contents.constData(); *line; ) {
+        const char *end = strchr(line, '\n');
+        if (!end)
+            end = line + strlen(line);
+
+        if (*line != '#' && end != line) {
+            double time = atof(line);
+
+            if (previous >= 0) {
+                double fps = 1000 / (time - previous);
+                if (intervals == 0 || fps < lowest)
+                    lowest = fps;
+                if (intervals == 0 || fps > highest)
+                    highest = fps;
+                intervals++;
+            }
+
+            previous = time;
+        }
+
+        line = *end ? end + 1 : end;
+    }
+}
+
+
+// Best of a few runs, in milliseconds. setup and teardown aren't timed.
+template <typename Setup, typename Function>
+static double bestTime(Setup setup, Function function) {
+    const int runs = 3;
+
+    double best = 0;
+
+    for (int i = 0; i < runs; i++) {
+        setup();
+
+        QElapsedTimer timer;
+        timer.start();
+
+        function();
+
+        double msecs = timer.nsecsElapsed() / 1000000.0;
+        if (i == 0 || msecs < best)
+            best = msecs;
+    }
+
+    return best;
+}
+
+
+static bool vsscript_available = false;
+
+
+// Best time to evaluate the script, in milliseconds, with a blank clip standing in for the source.
+// Returns -1 and sets error if the script can't be evaluated, e.g. when a plugin it uses is missing.
+static double evaluationTime(const std::string &script, int num_frames, std::string &error) {
+    if (!vsscript_available) {
+        error = "failed to initialise VSScript";
+        return -1;
+    }
+
+    // The final script takes the source from output index 1 if it's there.
+    std::string source =
+            "import vapoursynth as vs\n"
+            "vs.get_core().std.BlankClip(width=720, height=480, format=vs.YUV420P8, length=" + std::to_string(num_frames) + ", fpsnum=30000, fpsden=1001).set_output(index=1)\n";
+
+    VSScript *vsscript = nullptr;
+    bool failed = false;
+
+    double msecs = bestTime([&] () {
+        if (vsscript)
+            vsscript_freeScript(vsscript);
+        vsscript = nullptr;
+
+        if (!failed && (vsscript_createScript(&vsscript) || vsscript_evaluateScript(&vsscript, source.c_str(), "wobbly-bench-source", 0)))
+            failed = true;
+    }, [&] () {
+        if (!failed && vsscript_evaluateScript(&vsscript, script.c_str(), "wobbly-bench", 0))
+            failed = true;
+    });
+
+    if (failed) {
+        error = vsscript ? vsscript_getError(vsscript) : "failed to create VSScript object";
+
+        size_t end = error.find_first_of("\n");
+        if (end != std::string::npos)
+            error.erase(end);
+    }
+
+    if (vsscript)
+        vsscript_freeScript(vsscript);
+
+    return failed ? -1 : msecs;
+}
+
+
+static void benchmark(int num_frames) {
+    std::mt19937 rng(num_frames);
+
+    std::string base = QDir::tempPath().toStdString() + "/wobbly-bench-" + std::to_string(num_frames);
+    std::string wibbly_path = base + ".wibbly.json";
+    std::string wobbly_path = base + ".json";
+    std::string frame_data_path = base + ".frames.json";
+    std::string timecodes_path = base + ".timecodes.txt";
+
+    writeWibblyProject(wibbly_path, num_frames, rng);
+
+    {
+        WobblyProject project(true);
+        project.readProject(wibbly_path);
+        addWobblyEdits(project, rng);
+        project.writeProject(wobbly_path);
+
+        project.setFrameDataFileEnabled(true);
+        project.writeProject(frame_data_path);
+    }
+
+    std::unique_ptr<WobblyProject> project;
+
+    auto newProject = [&project] () {
+        project.reset(new WobblyProject(true));
+    };
+
+    auto readProject = [&project, &wobbly_path] () {
+        project.reset(new WobblyProject(true));
+        project->readProject(wobbly_path);
+    };
+
+    printf("%d frames, project file %.1f MiB\n", num_frames, QFileInfo(QString::fromStdString(wobbly_path)).size() / 1048576.0);
+
+    printf("    %-32s %10.1f ms\n", "readProject", bestTime(newProject, [&] () {
+        project->readProject(wobbly_path);
+    }));
+
+    printf("    %-32s %10.1f ms\n", "QJsonDocument::fromJson", bestTime([] () { }, [&] () {
+        parseWithQJsonDocument(wobbly_path);
+    }));
+
+    double reader_peak = readerPeakMemory("wobbly", wobbly_path);
+    if (reader_peak >= 0)
+        printf("    %-32s %10.1f MiB\n", "peak memory, readProject", reader_peak);
+
+    reader_peak = readerPeakMemory("qjson", wobbly_path);
+    if (reader_peak >= 0)
+        printf("    %-32s %10.1f MiB\n", "peak memory, fromJson", reader_peak);
+
+    printf("    %-32s %10.1f ms\n", "readProject, lazy metrics", bestTime(newProject, [&] () {
+        project->readProject(wobbly_path, true);
+    }));
+
+    printf("    %-32s %10.1f ms\n", "readProject, frame data file", bestTime(newProject, [&] () {
+        project->readProject(frame_data_path);
+    }));
+
+    printf("    %-32s %10.1f ms\n", "writeProject", bestTime(readProject, [&] () {
+        project->writeProject(wobbly_path);
+    }));
+
+    printf("    %-32s %10.1f ms\n", "writeProject, frame data file", bestTime(readProject, [&] () {
+        project->setFrameDataFileEnabled(true);
+        project->writeProject(frame_data_path);
+    }));
+
+    // What the autosave costs the GUI thread.
+    printf("    %-32s %10.1f ms\n", "createSnapshot", bestTime(readProject, [&] () {
+        std::unique_ptr<WobblyProject> snapshot(project->createSnapshot());
+    }));
+
+    printf("    %-32s %10.1f ms\n", "writeTimecodes", bestTime(readProject, [&] () {
+        project->writeTimecodes(timecodes_path);
+    }));
+
+    // The source is 29.97 fps and every cycle loses one frame, so the output must be 23.976 fps throughout.
+    double lowest_fps, highest_fps;
+    timecodesFrameRates(timecodes_path, lowest_fps, highest_fps);
+
+    const double expected_fps = 24000.0 / 1001;
+    if (std::fabs(lowest_fps - expected_fps) > 0.0001 || std::fabs(highest_fps - expected_fps) > 0.0001)
+        throw WobblyException("The timecodes go from " + std::to_string(lowest_fps) + " to " + std::to_string(highest_fps) + " fps instead of " + std::to_string(expected_fps) + " fps.");
+
+    printf("    %-32s %10.3f fps\n", "timecodes frame rate", lowest_fps);
+
+    size_t script_size = 0;
+    int section_clips = 0;
+    int num_sections = 0;
+
+    printf("    %-32s %10.1f ms\n", "generateFinalScript", bestTime(readProject, [&] () {
+        std::string script = project->generateFinalScript(false);
+        script_size = script.size();
+        section_clips = countSectionClips(script);
+        num_sections = (int)project->sections.size();
+    }));
+
+    // What the editor does after every match change.
+    printf("    %-32s %10.1f ms\n", "generateFinalScript, 1 match", bestTime([&] () {
+        readProject();
+        project->generateFinalScript(false);
+    }, [&] () {
+        project->setMatch(num_frames / 2, 'b');
+        project->generateFinalScript(false);
+    }));
+
+    std::string evaluation_error;
+    double evaluation = evaluationTime(project->generateFinalScript(false), num_frames, evaluation_error);
+    if (evaluation >= 0)
+        printf("    %-32s %10.1f ms\n", "evaluate final script", evaluation);
+    else
+        printf("    %-32s %10s (%s)\n", "evaluate final script", "not measured", evaluation_error.c_str());
+
+    project.reset();
+
+    printf("    %-32s %10.1f KiB\n", "script size", script_size / 1024.0);
+
+    printf("    %-32s %10d of %d sections\n", "section clips", section_clips, num_sections);
+
+    {
+        // Straight from Wibbly, without presets.
+        WobblyProject wibbly(true);
+        wibbly.readProject(wibbly_path);
+
+        printf("    %-32s %10d of %d sections\n", "section clips, no presets", countSectionClips(wibbly.generateFinalScript(false)), (int)wibbly.sections.size());
+    }
+
+    double peak = peakMemory();
+    if (peak >= 0)
+        printf("    %-32s %10.1f MiB\n", "peak memory", peak);
+
+    const std::string leftovers[] = {
+        wibbly_path,
+        wobbly_path,
+        frame_data_path,
+        frame_data_path + ".frames",
+        timecodes_path
+    };
+
+    for (size_t i = 0; i < sizeof(leftovers) / sizeof(leftovers[0]); i++)
+        QFile::remove(QString::fromStdString(leftovers[i]));
+}
+
+
+int main(int argc, char **argv) {
+    bench_path = argv[0];
+
+    if (argc == 4 && std::string(argv[1]) == "--peak-memory") {
+        try {
+            return printReaderPeakMemory(argv[2], argv[3]);
+        } catch (WobblyException &e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; i++)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+        sizes = { 10000, 100000, 500000 };
+
+    vsscript_available = vsscript_init() != 0;
+
+    int ret = 0;
+
+    try {
+        for (size_t i = 0; i < sizes.size(); i++)
+            benchmark(sizes[i]);
+    } catch (WobblyException &e) {
+        fprintf(stderr, "%s\n", e.what());
+        ret = 1;
+    }
+
+    if (vsscript_available)
+        vsscript_finalize();
+
+    return ret;
+}
@@ -0,0 +1,33 @@
+#ifndef BITS_H
+#define BITS_H
+
+
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+// Number of bits set in value.
+static inline int countBits(uint64_t value) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(value);
+#else
+    return __builtin_popcountll(value);
+#endif
+}
+
+
+// Index of the lowest bit set in value, which must not be 0.
+static inline int findLowestBit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+#endif // BITS_H
@@ -0,0 +1,60 @@
+#ifndef FENWICKTREE_H
+#define FENWICKTREE_H
+
+
+#include <cstddef>
+
+#include <vector>
+
+
+// Prefix sums over an array of ints, with O(log n) updates and queries.
+class FenwickTree {
+public:
+    // All elements become 0.
+    void assign(size_t size) {
+        tree.assign(size + 1, 0);
+    }
+
+    size_t size() const {
+        return tree.size() ? tree.size() - 1 : 0;
+    }
+
+    void add(int index, int value) {
+        for (size_t i = index + 1; i < tree.size(); i += i & (0 - i))
+            tree[i] += value;
+    }
+
+    // Sum of the first count elements.
+    int prefixSum(int count) const {
+        int sum = 0;
+        for (size_t i = count; i > 0; i -= i & (0 - i))
+            sum += tree[i];
+        return sum;
+    }
+
+    // Largest count for which accept(prefixSum(count), count) returns true. accept must return
+    // true for count 0, and once it returns false it must keep returning false for larger counts.
+    template <typename Accept>
+    int search(Accept accept) const {
+        size_t step = 1;
+        while (step * 2 < tree.size())
+            step *= 2;
+
+        size_t count = 0;
+        int sum = 0;
+
+        for (; step; step /= 2) {
+            if (count + step < tree.size() && accept(sum + tree[count + step], (int)(count + step))) {
+                count += step;
+                sum += tree[count];
+            }
+        }
+
+        return (int)count;
+    }
+
+private:
+    std::vector<int> tree; // One-based.
+};
+
+#endif // FENWICKTREE_H
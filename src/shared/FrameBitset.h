@@ -0,0 +1,175 @@
+#ifndef FRAMEBITSET_H
+#define FRAMEBITSET_H
+
+
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+#include "Bits.h"
+#include "FenwickTree.h"
+
+
+// One bit per frame, with rank and select in O(log n).
+class FrameBitset {
+public:
+    FrameBitset()
+        : num_frames(0)
+        , num_set(0)
+    { }
+
+    size_t size() const {
+        return num_frames;
+    }
+
+    // New frames start cleared.
+    void resize(size_t new_size) {
+        if (new_size < num_frames && new_size % 64)
+            words[new_size / 64] &= ((uint64_t)1 << (new_size % 64)) - 1;
+
+        words.resize((new_size + 63) / 64, 0);
+        num_frames = new_size;
+
+        word_counts.assign(words.size());
+        num_set = 0;
+        for (size_t i = 0; i < words.size(); i++) {
+            int bits = countBits(words[i]);
+            word_counts.add((int)i, bits);
+            num_set += bits;
+        }
+    }
+
+    bool test(int frame) const {
+        return (words[frame / 64] >> (frame % 64)) & 1;
+    }
+
+    // Return true if the bit changed.
+    bool set(int frame) {
+        uint64_t &word = words[frame / 64];
+        uint64_t bit = (uint64_t)1 << (frame % 64);
+
+        if (word & bit)
+            return false;
+
+        word |= bit;
+        word_counts.add(frame / 64, 1);
+        num_set++;
+        return true;
+    }
+
+    bool reset(int frame) {
+        uint64_t &word = words[frame / 64];
+        uint64_t bit = (uint64_t)1 << (frame % 64);
+
+        if (!(word & bit))
+            return false;
+
+        word &= ~bit;
+        word_counts.add(frame / 64, -1);
+        num_set--;
+        return true;
+    }
+
+    // Sets or resets frames first to last, a word at a time. Returns the number of frames that changed.
+    int setRange(int first, int last, bool value) {
+        int changed = 0;
+
+        for (int i = first / 64; i <= last / 64; i++)
+            changed += assignBits(i, rangeMask(i, first, last), value ? ~(uint64_t)0 : 0);
+
+        return changed;
+    }
+
+    // Copies of the words that hold frames first to last.
+    void getWords(int first, int last, std::vector<uint64_t> &result) const {
+        result.assign(words.cbegin() + first / 64, words.cbegin() + last / 64 + 1);
+    }
+
+    // Frames first to last take their bits from source, which came from getWords with the same range.
+    int setWords(int first, int last, const std::vector<uint64_t> &source) {
+        int changed = 0;
+
+        for (int i = first / 64; i <= last / 64; i++)
+            changed += assignBits(i, rangeMask(i, first, last), source[i - first / 64]);
+
+        return changed;
+    }
+
+    int count() const {
+        return num_set;
+    }
+
+    // Number of set frames before frame.
+    int rank(int frame) const {
+        if (frame <= 0)
+            return 0;
+
+        if ((size_t)frame >= num_frames)
+            return num_set;
+
+        int total = word_counts.prefixSum(frame / 64);
+
+        if (frame % 64)
+            total += countBits(words[frame / 64] & (((uint64_t)1 << (frame % 64)) - 1));
+
+        return total;
+    }
+
+    // The set frame with rank n, or -1.
+    int select(int n) const {
+        if (n < 0 || n >= num_set)
+            return -1;
+
+        int word_index = word_counts.search([n] (int sum, int) {
+            return sum <= n;
+        });
+
+        uint64_t word = words[word_index];
+        for (int i = n - word_counts.prefixSum(word_index); i > 0; i--)
+            word &= word - 1;
+
+        return word_index * 64 + findLowestBit(word);
+    }
+
+    // First set frame at or after frame, or -1.
+    int findNext(int frame) const {
+        return select(rank(frame));
+    }
+
+    // Last set frame at or before frame, or -1.
+    int findPrevious(int frame) const {
+        return select(rank(frame + 1) - 1);
+    }
+
+private:
+    // The bits of frames first to last that are in word word_index.
+    static uint64_t rangeMask(int word_index, int first, int last) {
+        int low = std::max(first - word_index * 64, 0);
+        int high = std::min(last - word_index * 64, 63);
+
+        uint64_t mask = high == 63 ? ~(uint64_t)0 : ((uint64_t)1 << (high + 1)) - 1;
+        return mask & ~(((uint64_t)1 << low) - 1);
+    }
+
+    int assignBits(int word_index, uint64_t mask, uint64_t value) {
+        uint64_t &word = words[word_index];
+        uint64_t changed = (word ^ value) & mask;
+
+        if (!changed)
+            return 0;
+
+        int difference = countBits(value & changed) - countBits(word & changed);
+        word ^= changed;
+        word_counts.add(word_index, difference);
+        num_set += difference;
+        return countBits(changed);
+    }
+
+    std::vector<uint64_t> words;
+    FenwickTree word_counts; // Number of set frames in each word.
+    size_t num_frames;
+    int num_set;
+};
+
+#endif // FRAMEBITSET_H
@@ -0,0 +1,167 @@
+#ifndef FRAMECOLUMNS_H
+#define FRAMECOLUMNS_H
+
+
+#include <cstdint>
+#include <cstring>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "PackedMatches.h"
+#include "WobblyException.h"
+
+
+// The per-frame data that never changes once read. Each column is either in memory or read
+// straight from a mapped frame data file. mapping keeps the mapped memory alive.
+
+
+class OriginalMatches {
+public:
+    OriginalMatches()
+        : mapped(nullptr)
+        , num_mapped(0)
+    { }
+
+    size_t size() const {
+        return mapped ? num_mapped : packed.size();
+    }
+
+    bool isMapped() const {
+        return mapped;
+    }
+
+    char get(int frame) const {
+        return mapped ? mapped[frame] : packed.get(frame);
+    }
+
+    void assign(const char *matches, size_t size) {
+        unmap();
+        packed.assign(matches, size);
+    }
+
+    // The matches must stay in memory as long as _mapping exists.
+    void map(const std::shared_ptr<const void> &_mapping, const char *matches, size_t size) {
+        for (size_t i = 0; i < size; i++)
+            if (matchCharToIndex(matches[i]) == 255)
+                throw WobblyException(std::string("Can't store match '") + matches[i] + "' for frame " + std::to_string(i) + ": must be one of p, c, n, b, u.");
+
+        packed = PackedMatches();
+        mapping = _mapping;
+        mapped = matches;
+        num_mapped = size;
+    }
+
+    // Copies mapped matches into memory first, unless the size stays the same.
+    void resize(size_t new_size, char match) {
+        if (mapped && new_size == num_mapped)
+            return;
+
+        unmap();
+        packed.resize(new_size, match);
+    }
+
+    void appendTo(std::string &str) const {
+        if (mapped)
+            str.append(mapped, num_mapped);
+        else
+            packed.appendTo(str);
+    }
+
+    std::string toString() const {
+        std::string str;
+        appendTo(str);
+        return str;
+    }
+
+private:
+    PackedMatches packed;
+
+    std::shared_ptr<const void> mapping;
+    const char *mapped;
+    size_t num_mapped;
+
+    void unmap() {
+        if (!mapped)
+            return;
+
+        packed.assign(mapped, num_mapped);
+        mapping.reset();
+        mapped = nullptr;
+        num_mapped = 0;
+    }
+};
+
+
+// The mics and the decimate metrics.
+class FrameMetrics {
+public:
+    // Layout of the mics in a frame data file: the five mics of each frame together.
+    typedef std::array<int16_t, 5> FileMics;
+
+    // In memory, as read from a project file. Unused while the column is mapped.
+    std::array<std::vector<int16_t>, 5> mics; // One column per match: p, c, n, b, u.
+    std::vector<int> decimate_metrics;
+
+    FrameMetrics()
+        : mapped_mics(nullptr)
+        , mapped_decimate_metrics(nullptr)
+    { }
+
+    int16_t getMic(int frame, int match_index) const {
+        if (!mapped_mics)
+            return mics[match_index][frame];
+
+        int16_t mic;
+        memcpy(&mic, mapped_mics + frame * sizeof(FileMics) + match_index * sizeof(int16_t), sizeof(mic));
+        return mic;
+    }
+
+    int getDecimateMetric(int frame) const {
+        return mapped_decimate_metrics ? mapped_decimate_metrics[frame] : decimate_metrics[frame];
+    }
+
+    // Null when the column is in memory.
+    const char *getMappedMics() const {
+        return mapped_mics;
+    }
+
+    const int32_t *getMappedDecimateMetrics() const {
+        return mapped_decimate_metrics;
+    }
+
+    // One FileMics per frame. They must stay in memory as long as _mapping exists.
+    void mapMics(const std::shared_ptr<const void> &_mapping, const char *data) {
+        for (int i = 0; i < 5; i++)
+            std::vector<int16_t>().swap(mics[i]);
+
+        mapping = _mapping;
+        mapped_mics = data;
+    }
+
+    void mapDecimateMetrics(const std::shared_ptr<const void> &_mapping, const int32_t *data) {
+        std::vector<int>().swap(decimate_metrics);
+
+        mapping = _mapping;
+        mapped_decimate_metrics = data;
+    }
+
+    // The columns in memory get num_frames values. The missing ones are 0.
+    void resize(size_t num_frames) {
+        if (!mapped_mics)
+            for (int i = 0; i < 5; i++)
+                mics[i].resize(num_frames, 0);
+
+        if (!mapped_decimate_metrics)
+            decimate_metrics.resize(num_frames, 0);
+    }
+
+private:
+    std::shared_ptr<const void> mapping; // Both mapped columns come from the same file.
+    const char *mapped_mics;
+    const int32_t *mapped_decimate_metrics;
+};
+
+#endif // FRAMECOLUMNS_H
@@ -0,0 +1,87 @@
+#ifndef INTERVALINDEX_H
+#define INTERVALINDEX_H
+
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+
+struct Interval {
+    int type;
+    int id;
+    int first;
+    int last;
+};
+
+
+// Returns the range that overlaps [first, last], or nullptr.
+// The ranges must not overlap each other. Key is the range's first frame.
+template <typename Range>
+static inline const Range *findOverlappingRange(const std::map<int, Range> &ranges, int first, int last) {
+    // Of the ranges that start before last, only the one that starts last can reach first.
+    auto it = ranges.upper_bound(last);
+
+    if (it == ranges.cbegin())
+        return nullptr;
+
+    it--;
+
+    if (it->second.last >= first)
+        return &it->second;
+
+    return nullptr;
+}
+
+
+// Flat, sorted storage for several layers of intervals. The intervals within one layer
+// must not overlap, so finding the ones that overlap a range takes one binary search per layer.
+class IntervalIndex {
+public:
+    void clear() {
+        layers.clear();
+        firsts.clear();
+        lasts.clear();
+    }
+
+    // Intervals added after this belong to the new layer. They must be added in order.
+    void beginLayer(int type, int id) {
+        layers.push_back({ type, id, firsts.size(), firsts.size() });
+    }
+
+    void add(int first, int last) {
+        firsts.push_back(first);
+        lasts.push_back(last);
+        layers.back().end++;
+    }
+
+    // Appends every interval that overlaps [first, last], layer by layer.
+    void findOverlapping(int first, int last, std::vector<Interval> &result) const {
+        for (size_t i = 0; i < layers.size(); i++) {
+            const Layer &layer = layers[i];
+
+            size_t j = std::upper_bound(firsts.cbegin() + layer.begin, firsts.cbegin() + layer.end, first) - firsts.cbegin();
+
+            // The interval before may still cover first.
+            if (j > layer.begin && lasts[j - 1] >= first)
+                j--;
+
+            for (; j < layer.end && firsts[j] <= last; j++)
+                result.push_back({ layer.type, layer.id, firsts[j], lasts[j] });
+        }
+    }
+
+private:
+    struct Layer {
+        int type;
+        int id;
+        size_t begin;
+        size_t end;
+    };
+
+    std::vector<Layer> layers;
+    std::vector<int> firsts;
+    std::vector<int> lasts;
+};
+
+#endif // INTERVALINDEX_H
@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <locale>
+#include <sstream>
+
+#include "JsonReader.h"
+#include "WobblyException.h"
+
+
+JsonReader::JsonReader(const char *data, size_t size)
+    : start(data)
+    , cur(data)
+    , end(data + size)
+{
+    // Skip the UTF-8 byte order mark, if any.
+    if (size >= 3 && (uint8_t)data[0] == 0xef && (uint8_t)data[1] == 0xbb && (uint8_t)data[2] == 0xbf)
+        cur += 3;
+}
+
+
+JsonReader::JsonReader(const char *data, size_t size, size_t offset)
+    : start(data)
+    , cur(data + std::min(offset, size))
+    , end(data + size)
+{
+
+}
+
+
+void JsonReader::error(const std::string &message) {
+    throw WobblyException("Failed to parse JSON at byte " + std::to_string(position()) + ": " + message);
+}
+
+
+size_t JsonReader::position() const {
+    return cur - start;
+}
+
+
+void JsonReader::skipWhitespace() {
+    while (cur < end && (*cur == ' ' || *cur == '\n' || *cur == '\r' || *cur == '\t'))
+        cur++;
+}
+
+
+char JsonReader::peek() {
+    skipWhitespace();
+
+    if (cur == end)
+        error("unexpected end of file.");
+
+    return *cur;
+}
+
+
+void JsonReader::expect(char c) {
+    if (peek() != c)
+        error(std::string("expected '") + c + "', found '" + *cur + "'.");
+
+    cur++;
+}
+
+
+void JsonReader::expectLiteral(const char *literal) {
+    for (const char *l = literal; *l; l++, cur++)
+        if (cur == end || *cur != *l)
+            error(std::string("expected '") + literal + "'.");
+}
+
+
+void JsonReader::beginObject() {
+    expect('{');
+    first_element.push_back(true);
+}
+
+
+bool JsonReader::nextKey(std::string &key) {
+    if (peek() == '}') {
+        cur++;
+        first_element.pop_back();
+        return false;
+    }
+
+    if (first_element.back())
+        first_element.back() = false;
+    else
+        expect(',');
+
+    readString(key);
+
+    expect(':');
+
+    return true;
+}
+
+
+void JsonReader::beginArray() {
+    expect('[');
+    first_element.push_back(true);
+}
+
+
+bool JsonReader::nextElement() {
+    if (peek() == ']') {
+        cur++;
+        first_element.pop_back();
+        return false;
+    }
+
+    if (first_element.back())
+        first_element.back() = false;
+    else
+        expect(',');
+
+    return true;
+}
+
+
+uint32_t JsonReader::readHex4() {
+    if (end - cur < 4)
+        error("truncated \\u escape sequence.");
+
+    uint32_t value = 0;
+
+    for (int i = 0; i < 4; i++, cur++) {
+        char c = *cur;
+        value <<= 4;
+
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            error("invalid \\u escape sequence.");
+    }
+
+    return value;
+}
+
+
+void JsonReader::appendCodePoint(std::string &str, uint32_t code_point) {
+    if (code_point < 0x80) {
+        str += (char)code_point;
+    } else if (code_point < 0x800) {
+        str += (char)(0xc0 | (code_point >> 6));
+        str += (char)(0x80 | (code_point & 0x3f));
+    } else if (code_point < 0x10000) {
+        str += (char)(0xe0 | (code_point >> 12));
+        str += (char)(0x80 | ((code_point >> 6) & 0x3f));
+        str += (char)(0x80 | (code_point & 0x3f));
+    } else {
+        str += (char)(0xf0 | (code_point >> 18));
+        str += (char)(0x80 | ((code_point >> 12) & 0x3f));
+        str += (char)(0x80 | ((code_point >> 6) & 0x3f));
+        str += (char)(0x80 | (code_point & 0x3f));
+    }
+}
+
+
+std::string JsonReader::readString() {
+    std::string str;
+    readString(str);
+    return str;
+}
+
+
+void JsonReader::readString(std::string &str) {
+    expect('"');
+
+    str.clear();
+
+    while (true) {
+        // Copy unescaped runs in one go.
+        const char *run = cur;
+        while (cur < end && *cur != '"' && *cur != '\\')
+            cur++;
+        str.append(run, cur - run);
+
+        if (cur == end)
+            error("unterminated string.");
+
+        if (*cur == '"') {
+            cur++;
+            return;
+        }
+
+        cur++; // The backslash.
+
+        if (cur == end)
+            error("unterminated string.");
+
+        char c = *cur++;
+
+        if (c == '"' || c == '\\' || c == '/') {
+            str += c;
+        } else if (c == 'b') {
+            str += '\b';
+        } else if (c == 'f') {
+            str += '\f';
+        } else if (c == 'n') {
+            str += '\n';
+        } else if (c == 'r') {
+            str += '\r';
+        } else if (c == 't') {
+            str += '\t';
+        } else if (c == 'u') {
+            uint32_t code_point = readHex4();
+
+            if (code_point >= 0xd800 && code_point < 0xdc00) {
+                // High surrogate, must be followed by a low surrogate.
+                if (end - cur < 2 || cur[0] != '\\' || cur[1] != 'u')
+                    error("unpaired surrogate in \\u escape sequence.");
+                cur += 2;
+
+                uint32_t low = readHex4();
+                if (low < 0xdc00 || low >= 0xe000)
+                    error("unpaired surrogate in \\u escape sequence.");
+
+                code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+            }
+
+            appendCodePoint(str, code_point);
+        } else {
+            error(std::string("invalid escape sequence '\\") + c + "'.");
+        }
+    }
+}
+
+
+int64_t JsonReader::readInt() {
+    skipWhitespace();
+
+    const char *number = cur;
+
+    bool negative = false;
+    if (cur < end && *cur == '-') {
+        negative = true;
+        cur++;
+    }
+
+    int64_t value = 0;
+    const char *digits = cur;
+    while (cur < end && *cur >= '0' && *cur <= '9') {
+        value = value * 10 + (*cur - '0');
+        cur++;
+    }
+
+    if (cur == digits)
+        error("expected a number.");
+
+    // Not an integer after all. Let readDouble deal with it.
+    if (cur < end && (*cur == '.' || *cur == 'e' || *cur == 'E')) {
+        cur = number;
+        return (int64_t)readDouble();
+    }
+
+    return negative ? -value : value;
+}
+
+
+double JsonReader::readDouble() {
+    skipWhitespace();
+
+    const char *number = cur;
+    skipNumber();
+
+    // strtod depends on the current locale, which Qt sets from the environment.
+    std::istringstream stream(std::string(number, cur - number));
+    stream.imbue(std::locale::classic());
+
+    double value;
+    stream >> value;
+
+    if (stream.fail())
+        error("invalid number '" + std::string(number, cur - number) + "'.");
+
+    return value;
+}
+
+
+bool JsonReader::readBool() {
+    if (peek() == 't') {
+        expectLiteral("true");
+        return true;
+    }
+
+    expectLiteral("false");
+    return false;
+}
+
+
+bool JsonReader::isString() {
+    return peek() == '"';
+}
+
+
+void JsonReader::skipString() {
+    expect('"');
+
+    while (cur < end && *cur != '"') {
+        if (*cur == '\\')
+            cur++;
+        cur++;
+    }
+
+    if (cur >= end)
+        error("unterminated string.");
+
+    cur++;
+}
+
+
+void JsonReader::skipNumber() {
+    const char *number = cur;
+
+    while (cur < end && ((*cur >= '0' && *cur <= '9') || *cur == '-' || *cur == '+' || *cur == '.' || *cur == 'e' || *cur == 'E'))
+        cur++;
+
+    if (cur == number)
+        error("expected a number.");
+}
+
+
+void JsonReader::skipValue() {
+    char c = peek();
+
+    if (c == '{') {
+        std::string key;
+        beginObject();
+        while (nextKey(key))
+            skipValue();
+    } else if (c == '[') {
+        beginArray();
+        while (nextElement())
+            skipValue();
+    } else if (c == '"') {
+        skipString();
+    } else if (c == 't') {
+        expectLiteral("true");
+    } else if (c == 'f') {
+        expectLiteral("false");
+    } else if (c == 'n') {
+        expectLiteral("null");
+    } else {
+        skipNumber();
+    }
+}
+
+
+void JsonReader::skipContainer() {
+    char c = peek();
+
+    if (c != '[' && c != '{')
+        error(std::string("expected '[' or '{', found '") + c + "'.");
+
+    // Only brackets and strings matter, so this is a plain byte scan.
+    size_t depth = 0;
+
+    while (cur < end) {
+        c = *cur++;
+
+        if (c == '[' || c == '{') {
+            depth++;
+        } else if (c == ']' || c == '}') {
+            if (--depth == 0)
+                return;
+        } else if (c == '"') {
+            while (cur < end && *cur != '"') {
+                if (*cur == '\\')
+                    cur++;
+                cur++;
+            }
+
+            if (cur >= end)
+                error("unterminated string.");
+
+            cur++;
+        }
+    }
+
+    error("unexpected end of file.");
+}
@@ -0,0 +1,57 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+
+// Pull parser that walks a JSON document in place, without building a DOM.
+// The buffer doesn't need to be null-terminated and must outlive the reader.
+class JsonReader {
+public:
+    JsonReader(const char *data, size_t size);
+    JsonReader(const char *data, size_t size, size_t offset); // Starts reading at offset. Positions are still counted from data.
+
+    void beginObject();
+    bool nextKey(std::string &key); // Returns false after consuming the closing brace.
+
+    void beginArray();
+    bool nextElement(); // Returns false after consuming the closing bracket.
+
+    std::string readString();
+    void readString(std::string &str);
+    int64_t readInt();
+    double readDouble();
+    bool readBool();
+    void skipValue();
+    void skipContainer(); // Skips an array or object by matching brackets. What's inside isn't checked.
+
+    bool isString();
+
+    size_t position() const;
+
+private:
+    const char *start;
+    const char *cur;
+    const char *end;
+
+    // One entry per open object or array. True until the first element has been read.
+    std::vector<bool> first_element;
+
+    void skipWhitespace();
+    char peek();
+    void expect(char c);
+    void expectLiteral(const char *literal);
+    void skipString();
+    void skipNumber();
+    void appendCodePoint(std::string &str, uint32_t code_point);
+    uint32_t readHex4();
+
+    [[noreturn]] void error(const std::string &message);
+};
+
+#endif // JSONREADER_H
@@ -0,0 +1,212 @@
+#include <cstring>
+#include <limits>
+#include <locale>
+#include <sstream>
+
+#include "JsonWriter.h"
+#include "WobblyException.h"
+
+
+JsonWriter::JsonWriter(QIODevice *_device)
+    : device(_device)
+    , after_key(false)
+{
+    buffer.reserve(BufferSize + 1024);
+}
+
+
+void JsonWriter::maybeFlush() {
+    if (buffer.size() >= BufferSize)
+        flush();
+}
+
+
+void JsonWriter::flush() {
+    if (!buffer.size())
+        return;
+
+    if (device->write(buffer.data(), buffer.size()) != (qint64)buffer.size())
+        throw WobblyException("Failed to write project file. Error message: " + device->errorString());
+
+    buffer.clear();
+}
+
+
+void JsonWriter::newLine() {
+    buffer += '\n';
+    buffer.append(containers.size() * 4, ' ');
+}
+
+
+void JsonWriter::beginValue() {
+    if (after_key) {
+        after_key = false;
+        return;
+    }
+
+    if (!containers.size())
+        return;
+
+    Container &container = containers.back();
+
+    if (container.first_element)
+        container.first_element = false;
+    else
+        buffer += container.inline_elements ? ", " : ",";
+
+    if (!container.inline_elements)
+        newLine();
+}
+
+
+void JsonWriter::beginObject(bool inline_elements) {
+    beginValue();
+    buffer += '{';
+    containers.push_back({ true, inline_elements });
+}
+
+
+void JsonWriter::endObject() {
+    Container container = containers.back();
+    containers.pop_back();
+
+    if (!container.inline_elements && !container.first_element)
+        newLine();
+    buffer += '}';
+
+    if (!containers.size())
+        buffer += '\n';
+
+    maybeFlush();
+}
+
+
+void JsonWriter::beginArray(bool inline_elements) {
+    beginValue();
+    buffer += '[';
+    containers.push_back({ true, inline_elements });
+}
+
+
+void JsonWriter::endArray() {
+    Container container = containers.back();
+    containers.pop_back();
+
+    if (!container.inline_elements && !container.first_element)
+        newLine();
+    buffer += ']';
+
+    if (!containers.size())
+        buffer += '\n';
+
+    maybeFlush();
+}
+
+
+void JsonWriter::writeKey(const char *key) {
+    writeString(key, strlen(key));
+    buffer += ": ";
+    after_key = true;
+}
+
+
+void JsonWriter::writeKey(const std::string &key) {
+    writeKey(key.c_str());
+}
+
+
+void JsonWriter::writeString(const char *str, size_t size) {
+    beginValue();
+
+    buffer += '"';
+
+    for (size_t i = 0; i < size; i++) {
+        char c = str[i];
+
+        if (c == '"') {
+            buffer += "\\\"";
+        } else if (c == '\\') {
+            buffer += "\\\\";
+        } else if (c == '\n') {
+            buffer += "\\n";
+        } else if (c == '\r') {
+            buffer += "\\r";
+        } else if (c == '\t') {
+            buffer += "\\t";
+        } else if ((uint8_t)c < 0x20) {
+            const char hex[] = "0123456789abcdef";
+            buffer += "\\u00";
+            buffer += hex[(uint8_t)c >> 4];
+            buffer += hex[c & 0xf];
+        } else {
+            buffer += c;
+        }
+    }
+
+    buffer += '"';
+
+    maybeFlush();
+}
+
+
+void JsonWriter::writeString(const std::string &str) {
+    writeString(str.data(), str.size());
+}
+
+
+void JsonWriter::writeInt(int64_t value) {
+    beginValue();
+
+    char digits[24];
+    int pos = sizeof(digits);
+
+    uint64_t abs_value = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+    do {
+        digits[--pos] = '0' + abs_value % 10;
+        abs_value /= 10;
+    } while (abs_value);
+
+    if (value < 0)
+        digits[--pos] = '-';
+
+    buffer.append(digits + pos, sizeof(digits) - pos);
+
+    maybeFlush();
+}
+
+
+void JsonWriter::writeDouble(double value) {
+    beginValue();
+
+    // Use the shortest representation that survives the round trip. Not locale-dependent.
+    std::string str;
+
+    for (int precision = 15; precision <= std::numeric_limits<double>::max_digits10; precision++) {
+        std::ostringstream stream;
+        stream.imbue(std::locale::classic());
+        stream.precision(precision);
+        stream << value;
+        str = stream.str();
+
+        std::istringstream check(str);
+        check.imbue(std::locale::classic());
+        double round_trip;
+        check >> round_trip;
+        if (round_trip == value)
+            break;
+    }
+
+    buffer += str;
+
+    maybeFlush();
+}
+
+
+void JsonWriter::writeBool(bool value) {
+    beginValue();
+
+    buffer += value ? "true" : "false";
+
+    maybeFlush();
+}
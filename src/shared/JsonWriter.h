@@ -0,0 +1,57 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include <QIODevice>
+
+
+// Writes JSON straight to a device, in fixed-size chunks.
+// Containers started with inline = true put all their elements on one line.
+class JsonWriter {
+public:
+    JsonWriter(QIODevice *_device);
+
+    void beginObject(bool inline_elements = false);
+    void endObject();
+
+    void beginArray(bool inline_elements = false);
+    void endArray();
+
+    void writeKey(const char *key);
+    void writeKey(const std::string &key);
+
+    void writeString(const char *str, size_t size);
+    void writeString(const std::string &str);
+    void writeInt(int64_t value);
+    void writeDouble(double value);
+    void writeBool(bool value);
+
+    void flush(); // Must be called at the end.
+
+private:
+    enum {
+        BufferSize = 1 << 16
+    };
+
+    QIODevice *device;
+    std::string buffer;
+
+    struct Container {
+        bool first_element;
+        bool inline_elements;
+    };
+
+    std::vector<Container> containers;
+    bool after_key;
+
+    void beginValue();
+    void newLine();
+    void maybeFlush();
+};
+
+#endif // JSONWRITER_H
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "MatchOverrides.h"
+#include "PackedMatches.h"
+#include "WobblyException.h"
+
+
+const std::map<int, MatchRun> &MatchOverrides::getRuns() const {
+    return runs;
+}
+
+
+const MatchRun *MatchOverrides::find(int frame) const {
+    auto it = runs.upper_bound(frame);
+
+    if (it == runs.cbegin())
+        return nullptr;
+
+    it--;
+
+    if (it->second.last >= frame)
+        return &it->second;
+
+    return nullptr;
+}
+
+
+void MatchOverrides::getRange(int first, int last, std::vector<MatchRun> &result) const {
+    auto it = runs.upper_bound(first);
+
+    if (it != runs.cbegin() && std::prev(it)->second.last >= first)
+        it--;
+
+    for (; it != runs.cend() && it->second.first <= last; it++) {
+        MatchRun run = it->second;
+        run.first = std::max(run.first, first);
+        run.last = std::min(run.last, last);
+        result.push_back(run);
+    }
+}
+
+
+void MatchOverrides::erase(int first, int last) {
+    auto it = runs.upper_bound(last);
+
+    // Walk back over every run that starts before last, until one ends before first.
+    while (it != runs.begin()) {
+        auto run = std::prev(it);
+
+        if (run->second.last < first)
+            break;
+
+        MatchRun old_run = run->second;
+        it = runs.erase(run);
+
+        // Keep the parts outside the erased range. The origin stays, so the pattern lines up.
+        if (old_run.last > last) {
+            MatchRun right = old_run;
+            right.first = last + 1;
+            it = runs.insert(std::make_pair(right.first, right)).first;
+        }
+
+        if (old_run.first < first) {
+            MatchRun left = old_run;
+            left.last = first - 1;
+            it = runs.insert(std::make_pair(left.first, left)).first;
+        }
+    }
+}
+
+
+// True if b carries on a's sequence, even when the patterns are written differently,
+// like "pc" and "cp", or "pc" and "pcpc". a must start before b.
+static bool sameSequence(const MatchRun &a, const MatchRun &b) {
+    // Both sequences repeat after a.length * b.length frames.
+    for (int i = b.first; i < b.first + a.length * b.length; i++)
+        if (a.get(i) != b.get(i))
+            return false;
+
+    return true;
+}
+
+
+void MatchOverrides::mergeWithNeighbours(std::map<int, MatchRun>::iterator it) {
+    if (it != runs.begin()) {
+        auto left = std::prev(it);
+
+        if (left->second.last + 1 == it->second.first && sameSequence(left->second, it->second)) {
+            left->second.last = it->second.last;
+            runs.erase(it);
+            it = left;
+        }
+    }
+
+    auto right = std::next(it);
+
+    if (right != runs.end() && it->second.last + 1 == right->second.first && sameSequence(it->second, right->second)) {
+        it->second.last = right->second.last;
+        runs.erase(right);
+    }
+}
+
+
+void MatchOverrides::setPattern(int first, int last, int origin, const std::string &pattern) {
+    if (pattern.empty() || pattern.size() > 5)
+        throw WobblyException("Can't use match pattern '" + pattern + "': must be between 1 and 5 characters long.");
+
+    for (size_t i = 0; i < pattern.size(); i++)
+        if (matchCharToIndex(pattern[i]) == 255)
+            throw WobblyException("Can't use match pattern '" + pattern + "': must contain only p, c, n, b, u.");
+
+    if (first > last)
+        return;
+
+    erase(first, last);
+
+    MatchRun run;
+    run.first = first;
+    run.last = last;
+    run.length = (int)pattern.size();
+    memcpy(run.pattern, pattern.data(), run.length);
+
+    // Keep the origin close to the run, with the same phase, so frame - origin stays small.
+    run.origin = first - (((first - origin) % run.length) + run.length) % run.length;
+
+    mergeWithNeighbours(runs.insert(std::make_pair(first, run)).first);
+}
+
+
+void MatchOverrides::set(int frame, char match, char original) {
+    if (match == original) {
+        erase(frame, frame);
+        return;
+    }
+
+    setPattern(frame, frame, frame, std::string(1, match));
+}
+
+
+void MatchOverrides::clear() {
+    runs.clear();
+}
+
+
+void MatchOverrides::apply(std::string &str, size_t start) const {
+    for (auto it = runs.cbegin(); it != runs.cend(); it++) {
+        const MatchRun &run = it->second;
+
+        for (int i = run.first; i <= run.last && start + i < str.size(); i++)
+            str[start + i] = run.get(i);
+    }
+}
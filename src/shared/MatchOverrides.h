@@ -0,0 +1,55 @@
+#ifndef MATCHOVERRIDES_H
+#define MATCHOVERRIDES_H
+
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+// Frames first to last use the repeating pattern, which starts at frame origin.
+struct MatchRun {
+    int first;
+    int last;
+    int origin;
+    int length;
+    char pattern[5];
+
+    char get(int frame) const {
+        return pattern[(frame - origin) % length];
+    }
+};
+
+
+// Matches that differ from the original matches, as sorted runs that don't overlap.
+// Frames not covered by any run use their original match.
+class MatchOverrides {
+public:
+    const std::map<int, MatchRun> &getRuns() const;
+
+    const MatchRun *find(int frame) const;
+
+    // Appends the runs that overlap [first, last], cut to fit.
+    void getRange(int first, int last, std::vector<MatchRun> &result) const;
+
+    // Frames first to last go back to their original matches.
+    void erase(int first, int last);
+
+    // pattern[0] is used at frame origin. At most 5 characters long.
+    void setPattern(int first, int last, int origin, const std::string &pattern);
+
+    // Doesn't store anything if match is the same as original.
+    void set(int frame, char match, char original);
+
+    void clear();
+
+    // Writes the overridden matches over the original matches, which start at str[start].
+    void apply(std::string &str, size_t start) const;
+
+private:
+    std::map<int, MatchRun> runs; // Key is MatchRun::first
+
+    void mergeWithNeighbours(std::map<int, MatchRun>::iterator it);
+};
+
+#endif // MATCHOVERRIDES_H
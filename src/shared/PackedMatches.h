@@ -0,0 +1,95 @@
+#ifndef PACKEDMATCHES_H
+#define PACKEDMATCHES_H
+
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "WobblyException.h"
+
+
+static inline uint8_t matchCharToIndex(char match) {
+    if (match == 'p')
+        return 0;
+    if (match == 'c')
+        return 1;
+    if (match == 'n')
+        return 2;
+    if (match == 'b')
+        return 3;
+    if (match == 'u')
+        return 4;
+
+    return 255;
+}
+
+
+// One match per frame, three bits each, 21 to a 64 bit word.
+class PackedMatches {
+public:
+    PackedMatches()
+        : num_frames(0)
+    { }
+
+    size_t size() const {
+        return num_frames;
+    }
+
+    void resize(size_t new_size, char match) {
+        size_t old_size = num_frames;
+
+        words.resize((new_size + MatchesPerWord - 1) / MatchesPerWord, 0);
+        num_frames = new_size;
+
+        for (size_t i = old_size; i < new_size; i++)
+            set((int)i, match);
+    }
+
+    char get(int frame) const {
+        uint64_t word = words[frame / MatchesPerWord];
+        return "pcnbu???"[(word >> (frame % MatchesPerWord * 3)) & 7];
+    }
+
+    void set(int frame, char match) {
+        uint8_t index = matchCharToIndex(match);
+        if (index == 255)
+            throw WobblyException(std::string("Can't store match '") + match + "' for frame " + std::to_string(frame) + ": must be one of p, c, n, b, u.");
+
+        uint64_t &word = words[frame / MatchesPerWord];
+        int shift = frame % MatchesPerWord * 3;
+        word = (word & ~((uint64_t)7 << shift)) | ((uint64_t)index << shift);
+    }
+
+    // Replaces everything.
+    void assign(const char *matches, size_t size) {
+        words.assign((size + MatchesPerWord - 1) / MatchesPerWord, 0);
+        num_frames = size;
+
+        for (size_t i = 0; i < size; i++)
+            set((int)i, matches[i]);
+    }
+
+    void appendTo(std::string &str) const {
+        str.reserve(str.size() + num_frames);
+        for (size_t i = 0; i < num_frames; i++)
+            str += get((int)i);
+    }
+
+    std::string toString() const {
+        std::string str;
+        appendTo(str);
+        return str;
+    }
+
+private:
+    enum {
+        MatchesPerWord = 21
+    };
+
+    std::vector<uint64_t> words;
+    size_t num_frames;
+};
+
+#endif // PACKEDMATCHES_H
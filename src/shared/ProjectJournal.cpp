@@ -0,0 +1,82 @@
+#include "ProjectJournal.h"
+#include "WobblyException.h"
+
+
+ProjectJournal::ProjectJournal(const std::string &_path)
+    : path(_path)
+    , file(QString::fromStdString(_path))
+    , json(&file)
+    , committed_size(0)
+{
+
+}
+
+
+void ProjectJournal::create(const std::string &base_id) {
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        throw WobblyException("Couldn't create journal file '" + path + "'. Error message: " + file.errorString().toStdString());
+
+    beginRecord("base").writeString(base_id);
+    endRecord();
+
+    committed_size = file.size();
+}
+
+
+void ProjectJournal::open(qint64 valid_size, qint64 _committed_size) {
+    if (!file.open(QIODevice::ReadWrite))
+        throw WobblyException("Couldn't open journal file '" + path + "'. Error message: " + file.errorString().toStdString());
+
+    // Drop whatever is left of a record that was being written when Wobbly crashed.
+    if (file.size() != valid_size && !file.resize(valid_size))
+        throw WobblyException("Couldn't truncate journal file '" + path + "'. Error message: " + file.errorString().toStdString());
+
+    if (!file.seek(valid_size))
+        throw WobblyException("Couldn't seek in journal file '" + path + "'. Error message: " + file.errorString().toStdString());
+
+    committed_size = _committed_size;
+}
+
+
+JsonWriter &ProjectJournal::beginRecord(const char *operation) {
+    json.beginArray(true);
+    json.writeString(operation);
+    return json;
+}
+
+
+void ProjectJournal::endRecord() {
+    json.endArray();
+    json.flush();
+
+    // Hand it to the operating system right away, so it survives if Wobbly crashes.
+    if (!file.flush())
+        throw WobblyException("Couldn't write to journal file '" + path + "'. Error message: " + file.errorString().toStdString());
+}
+
+
+void ProjectJournal::commit() {
+    beginRecord("commit");
+    endRecord();
+
+    committed_size = file.size();
+}
+
+
+void ProjectJournal::rollback() {
+    if (file.size() == committed_size)
+        return;
+
+    if (!file.resize(committed_size) || !file.seek(committed_size))
+        throw WobblyException("Couldn't truncate journal file '" + path + "'. Error message: " + file.errorString().toStdString());
+}
+
+
+qint64 ProjectJournal::size() {
+    return file.size();
+}
+
+
+const std::string &ProjectJournal::getPath() {
+    return path;
+}
@@ -0,0 +1,38 @@
+#ifndef PROJECTJOURNAL_H
+#define PROJECTJOURNAL_H
+
+
+#include <string>
+
+#include <QFile>
+
+#include "JsonWriter.h"
+
+
+// Append-only log of the changes made to a project since it was last written in full.
+// One record per line, each record a JSON array whose first element is the name of the operation.
+// The first record identifies the project file the journal applies to, and "commit" records mark saves.
+class ProjectJournal {
+public:
+    ProjectJournal(const std::string &_path);
+
+    void create(const std::string &base_id);
+    void open(qint64 valid_size, qint64 _committed_size); // For an existing journal, after it was replayed.
+
+    JsonWriter &beginRecord(const char *operation);
+    void endRecord();
+
+    void commit();
+    void rollback(); // Throws away the records written since the last commit.
+
+    qint64 size();
+    const std::string &getPath();
+
+private:
+    std::string path;
+    QFile file;
+    JsonWriter json;
+    qint64 committed_size;
+};
+
+#endif // PROJECTJOURNAL_H
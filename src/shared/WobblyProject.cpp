@@ -1,766 +1,3085 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <cstdio>
 #include <cstdint>
+#include <functional>
+#include <locale>
 #include <map>
+#include <random>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include <QDir>
 #include <QFile>
-#include <QJsonArray>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QStringList>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtConcurrent>
 
+#include "Bits.h"
+#include "JsonReader.h"
+#include "JsonWriter.h"
 #include "WobblyException.h"
 #include "WobblyProject.h"
 
 
 WobblyProject::WobblyProject(bool _is_wobbly)
     : is_wobbly(_is_wobbly)
+    , frame_data_file_enabled(false)
+    , journal_enabled(false)
+    , original_matches(std::make_shared<OriginalMatches>())
+    , metrics(std::make_shared<FrameMetrics>())
+    , combed_frames(std::make_shared<FrameBitset>())
+    , decimation(std::make_shared<DecimatedCycles>())
+    , metrics_in_frame_data_file(false)
+    , mics_offset(-1)
+    , decimate_metrics_offset(-1)
+    , annotations_dirty(true)
+    , timing_dirty(true)
+    , undo_paused(0)
+    , next_change_listener_id(0)
+    , fieldhint_matches_offset(0)
+    , is_snapshot(false)
+    , journal_stopped(false)
+    , journal_paused(0)
+    , journal_recovered_records(0)
 {
-
+    invalidateScriptFragments();
 }
 
 
-void WobblyProject::writeProject(const std::string &path) {
-    QFile file(QString::fromStdString(path));
+WobblyProject *WobblyProject::createSnapshot() {
+    // The per-frame data is shared. Metrics that weren't loaded yet are loaded by the snapshot's
+    // writeProject, in the thread that writes it.
 
-    if (!file.open(QIODevice::WriteOnly))
-        throw WobblyException("Couldn't open project file. Error message: " + file.errorString());
+    // The undo history stays behind. Its functions act on this project.
+    std::vector<UndoStep> saved_undo_steps, saved_redo_steps;
+    std::vector<std::function<void ()> > saved_pending_inverses;
+    saved_undo_steps.swap(undo_steps);
+    saved_redo_steps.swap(redo_steps);
+    saved_pending_inverses.swap(pending_inverses);
 
-    project_path = path;
+    // So do the script fragments, which can be big and aren't needed for writing.
+    std::array<std::string, NumScriptFragments> saved_script_fragments;
+    std::array<bool, NumScriptFragments> saved_script_fragments_valid = script_fragments_valid;
+    saved_script_fragments.swap(script_fragments);
+    invalidateScriptFragments();
 
-    QJsonObject json_project;
+    WobblyProject *snapshot = new WobblyProject(*this);
 
-    json_project.insert("wibbly wobbly version", 42); // XXX use real version
+    undo_steps.swap(saved_undo_steps);
+    redo_steps.swap(saved_redo_steps);
+    pending_inverses.swap(saved_pending_inverses);
+    script_fragments.swap(saved_script_fragments);
+    script_fragments_valid = saved_script_fragments_valid;
 
+    // Nor tell this project's listeners about anything.
+    snapshot->change_listeners.clear();
 
-    json_project.insert("input file", QString::fromStdString(input_file));
+    // The snapshot must not touch this project's journal or frame data file. It keeps both
+    // settings, so the autosave has them, but writes a frame data file of its own.
+    snapshot->journal.reset();
+    snapshot->is_snapshot = true;
 
+    return snapshot;
+}
 
-    QJsonArray json_fps;
-    json_fps.append((qint64)fps_num);
-    json_fps.append((qint64)fps_den);
-    json_project.insert("input frame rate", json_fps);
 
+// Gives the project its own copy of data it shares with a snapshot. Must be called before changing the data.
+template <typename T>
+static T &detach(std::shared_ptr<T> &data) {
+    if (data.use_count() > 1)
+        data = std::make_shared<T>(*data);
 
-    QJsonArray json_resolution;
-    json_resolution.append(width);
-    json_resolution.append(height);
-    json_project.insert("input resolution", json_resolution);
+    return *data;
+}
 
 
-    QJsonArray json_trims;
+// Mutations made while this exists are part of a bigger operation, which is recorded on its own.
+struct WobblyProject::JournalPause {
+    WobblyProject *project;
 
-    for (auto it = trims.cbegin(); it != trims.cend(); it++) {
-        QJsonArray json_trim;
-        json_trim.append(it->second.first);
-        json_trim.append(it->second.last);
-        json_trims.append(json_trim);
+    JournalPause(WobblyProject *_project)
+        : project(_project)
+    {
+        project->journal_paused++;
     }
-    json_project.insert("trim", json_trims);
 
+    ~JournalPause() {
+        project->journal_paused--;
+    }
+};
 
-    QJsonObject json_vfm_parameters;
 
-    for (auto it = vfm_parameters.cbegin(); it != vfm_parameters.cend(); it++)
-        json_vfm_parameters.insert(QString::fromStdString(it->first), it->second);
+static void writeJournalValue(JsonWriter &json, int value) {
+    json.writeInt(value);
+}
 
-    json_project.insert("vfm parameters", json_vfm_parameters);
+static void writeJournalValue(JsonWriter &json, int64_t value) {
+    json.writeInt(value);
+}
 
+static void writeJournalValue(JsonWriter &json, bool value) {
+    json.writeBool(value);
+}
 
-    QJsonObject json_vdecimate_parameters;
+static void writeJournalValue(JsonWriter &json, char value) {
+    json.writeString(&value, 1);
+}
 
-    for (auto it = vdecimate_parameters.cbegin(); it != vdecimate_parameters.cend(); it++)
-        json_vdecimate_parameters.insert(QString::fromStdString(it->first), it->second);
+static void writeJournalValue(JsonWriter &json, const std::string &value) {
+    json.writeString(value);
+}
 
-    json_project.insert("vdecimate parameters", json_vdecimate_parameters);
+static void writeJournalValue(JsonWriter &json, const std::vector<std::string> &values) {
+    json.beginArray(true);
+    for (size_t i = 0; i < values.size(); i++)
+        json.writeString(values[i]);
+    json.endArray();
+}
 
+static void writeJournalValue(JsonWriter &json, const std::map<int, FrameRange> &ranges) {
+    json.beginArray(true);
+    for (auto it = ranges.cbegin(); it != ranges.cend(); it++) {
+        json.beginArray(true);
+        json.writeInt(it->second.first);
+        json.writeInt(it->second.last);
+        json.endArray();
+    }
+    json.endArray();
+}
 
-    QJsonArray json_mics, json_matches, json_combed_frames, json_decimated_frames, json_decimate_metrics;
 
-    for (size_t i = 0; i < mics.size(); i++) {
-        QJsonArray json_mic;
-        for (int j = 0; j < 5; j++)
-            json_mic.append(mics[i][j]);
-        json_mics.append(json_mic);
-    }
+template <typename... Args>
+void WobblyProject::journalRecord(const char *operation, const Args &... args) {
+    if (journal_paused)
+        return;
 
-    for (size_t i = 0; i < matches.size(); i++)
-        json_matches.append(QString(matches[i]));
+    // Every call that changes the project ends up here, once.
+    finishUndoStep();
 
-    for (auto it = combed_frames.cbegin(); it != combed_frames.cend(); it++)
-        json_combed_frames.append(*it);
+    if (!journal)
+        return;
 
-    for (size_t i = 0; i < decimated_frames.size(); i++)
-        for (auto it = decimated_frames[i].cbegin(); it != decimated_frames[i].cend(); it++)
-            json_decimated_frames.append((int)i * 5 + *it);
+    JsonWriter &json = journal->beginRecord(operation);
 
-    for (size_t i = 0; i < decimate_metrics.size(); i++)
-        json_decimate_metrics.append(decimate_metrics[i]);
+    int expand[] = { 0, (writeJournalValue(json, args), 0)... };
+    (void)expand;
 
-    json_project.insert("mics", json_mics);
-    json_project.insert("matches", json_matches);
-    json_project.insert("combed frames", json_combed_frames);
-    json_project.insert("decimated frames", json_decimated_frames);
-    json_project.insert("decimate metrics", json_decimate_metrics);
+    journal->endRecord();
+}
 
 
-    QJsonArray json_sections;
+// Mutations made while this exists are not undoable, like the ones that build the project when reading it.
+struct WobblyProject::UndoPause {
+    WobblyProject *project;
 
-    for (auto it = sections.cbegin(); it != sections.cend(); it++) {
-        QJsonObject json_section;
-        json_section.insert("start", it->second.start);
-        QJsonArray json_presets;
-        for (size_t i = 0; i < it->second.presets.size(); i++)
-            json_presets.append(QString::fromStdString(it->second.presets[i]));
-        json_section.insert("presets", json_presets);
-        json_section.insert("fps_num", (qint64)it->second.fps_num);
-        json_section.insert("fps_den", (qint64)it->second.fps_den);
-        json_section.insert("num_frames", it->second.num_frames);
+    UndoPause(WobblyProject *_project)
+        : project(_project)
+    {
+        project->undo_paused++;
+    }
 
-        json_sections.append(json_section);
+    ~UndoPause() {
+        project->undo_paused--;
     }
+};
 
-    json_project.insert("sections", json_sections);
 
+void WobblyProject::undoRecord(const std::function<void ()> &inverse) {
+    if (undo_paused)
+        return;
 
-    if (is_wobbly) {
-        QJsonArray json_presets, json_frozen_frames;
+    pending_inverses.push_back(inverse);
+}
 
-        for (auto it = presets.cbegin(); it != presets.cend(); it++) {
-            QJsonObject json_preset;
-            json_preset.insert("name", QString::fromStdString(it->second.name));
-            json_preset.insert("contents", QString::fromStdString(it->second.contents));
 
-            json_presets.append(json_preset);
-        }
+void WobblyProject::undoRecordMatches(int first, int last) {
+    if (undo_paused)
+        return;
 
-        for (auto it = frozen_frames.cbegin(); it != frozen_frames.cend(); it++) {
-            QJsonArray json_ff;
-            json_ff.append(it->second.first);
-            json_ff.append(it->second.last);
-            json_ff.append(it->second.replacement);
+    std::vector<MatchRun> old_runs;
+    matches.getRange(first, last, old_runs);
 
-            json_frozen_frames.append(json_ff);
-        }
+    undoRecord([this, first, last, old_runs] () {
+        undoRecordMatches(first, last);
 
-        json_project.insert("presets", json_presets);
-        json_project.insert("frozen frames", json_frozen_frames);
+        matches.erase(first, last);
+        for (size_t i = 0; i < old_runs.size(); i++)
+            matches.setPattern(old_runs[i].first, old_runs[i].last, old_runs[i].origin, std::string(old_runs[i].pattern, old_runs[i].length));
 
+        notifyChange(ChangeMatches, first, last);
+    });
+}
 
-        QJsonArray json_custom_lists;
 
-        for (size_t i = 0; i < custom_lists.size(); i++) {
-            QJsonObject json_custom_list;
-            json_custom_list.insert("name", QString::fromStdString(custom_lists[i].name));
-            json_custom_list.insert("preset", QString::fromStdString(custom_lists[i].preset));
-            json_custom_list.insert("position", custom_lists[i].position);
-            QJsonArray json_frames;
-            for (auto it = custom_lists[i].frames.cbegin(); it != custom_lists[i].frames.cend(); it++) {
-                QJsonArray json_pair;
-                json_pair.append(it->second.first);
-                json_pair.append(it->second.last);
-                json_frames.append(json_pair);
-            }
-            json_custom_list.insert("frames", json_frames);
+// The bits of frames first to last that are in the cycle.
+static uint8_t cycleRangeMask(int cycle, int first, int last) {
+    int low = std::max(first - cycle * 5, 0);
+    int high = std::min(last - cycle * 5, 4);
 
-            json_custom_lists.append(json_custom_list);
-        }
+    return ((1 << (high + 1)) - 1) & ~((1 << low) - 1);
+}
 
-        json_project.insert("custom lists", json_custom_lists);
 
+void WobblyProject::undoRecordDecimation(int first, int last) {
+    if (undo_paused)
+        return;
 
-        if (resize.enabled) {
-            QJsonObject json_resize;
-            json_resize.insert("width", resize.width);
-            json_resize.insert("height", resize.height);
-            json_project.insert("resize", json_resize);
-        }
+    std::vector<uint8_t> old_cycles(decimation->frames.cbegin() + first / 5, decimation->frames.cbegin() + last / 5 + 1);
 
-        if (crop.enabled) {
-            QJsonObject json_crop;
-            json_crop.insert("left", crop.left);
-            json_crop.insert("top", crop.top);
-            json_crop.insert("right", crop.right);
-            json_crop.insert("bottom", crop.bottom);
-            json_project.insert("crop", json_crop);
-        }
-    }
+    undoRecord([this, first, last, old_cycles] () {
+        undoRecordDecimation(first, last);
 
-    QJsonDocument json_doc(json_project);
+        for (int i = first / 5; i <= last / 5; i++)
+            setCycleDecimation(i, cycleRangeMask(i, first, last), old_cycles[i - first / 5]);
 
-    file.write(json_doc.toJson(QJsonDocument::Indented));
+        notifyChange(ChangeDecimation, first, last);
+    });
 }
 
-void WobblyProject::readProject(const std::string &path) {
-    // XXX Make sure the things only written by Wobbly get sane defaults. Actually, make sure everything has sane defaults, since Wibbly doesn't always write all the categories.
 
-    QFile file(QString::fromStdString(path));
+void WobblyProject::undoRecordCombedFrames(int first, int last) {
+    if (undo_paused)
+        return;
 
-    if (!file.open(QIODevice::ReadOnly))
-        throw WobblyException("Couldn't open project file. Error message: " + file.errorString());
+    std::vector<uint64_t> old_words;
+    combed_frames->getWords(first, last, old_words);
 
-    project_path = path;
+    undoRecord([this, first, last, old_words] () {
+        undoRecordCombedFrames(first, last);
 
-    QByteArray data = file.readAll();
+        detach(combed_frames).setWords(first, last, old_words);
+
+        notifyChange(ChangeCombedFrames, first, last);
+    });
+}
 
-    QJsonDocument json_doc(QJsonDocument::fromJson(data));
 
-    QJsonObject json_project = json_doc.object();
+template <typename Function>
+void WobblyProject::atomicChange(Function change) {
+    size_t first_inverse = pending_inverses.size();
 
+    JournalPause pause(this);
 
-    //int version = (int)json_project["wibbly wobbly version"].toDouble();
+    try {
+        change();
+    } catch (...) {
+        rollbackPendingInverses(first_inverse);
+        throw;
+    }
+}
 
 
-    input_file = json_project["input file"].toString().toStdString();
+void WobblyProject::rollbackPendingInverses(size_t first) {
+    if (undo_paused) {
+        // Nothing was recorded, so the change can't be reversed, and the journal can't replay it.
+        if (journal) {
+            journal.reset();
+            journal_stopped = true;
+        }
+        return;
+    }
 
+    std::vector<std::function<void ()> > inverses(pending_inverses.begin() + first, pending_inverses.end());
+    pending_inverses.resize(first);
 
-    fps_num = (int64_t)json_project["input frame rate"].toArray()[0].toDouble();
-    fps_den = (int64_t)json_project["input frame rate"].toArray()[1].toDouble();
+    UndoPause pause(this);
 
+    for (size_t i = inverses.size(); i > 0; i--)
+        inverses[i - 1]();
+}
 
-    width = (int)json_project["input resolution"].toArray()[0].toDouble();
-    height = (int)json_project["input resolution"].toArray()[1].toDouble();
 
+void WobblyProject::finishUndoStep() {
+    if (pending_inverses.empty())
+        return;
 
-    num_frames[PostSource] = 0;
+    UndoStep step;
+    step.inverses.swap(pending_inverses);
+    step.in_journal = (bool)journal;
+    undo_steps.push_back(std::move(step));
 
-    QJsonArray json_trims = json_project["trim"].toArray();
-    for (int i = 0; i < json_trims.size(); i++) {
-        QJsonArray json_trim = json_trims[i].toArray();
-        FrameRange range;
-        range.first = (int)json_trim[0].toDouble();
-        range.last = (int)json_trim[1].toDouble();
-        trims.insert(std::make_pair(range.first, range));
-        num_frames[PostSource] += range.last - range.first + 1;
-    }
+    redo_steps.clear();
+}
 
-    num_frames[PostFieldMatch] = num_frames[PostSource];
 
-    QJsonObject json_vfm_parameters = json_project["vfm parameters"].toObject();
+void WobblyProject::applyUndoStep(std::vector<UndoStep> &from, std::vector<UndoStep> &to, const char *operation) {
+    finishUndoStep();
 
-    QStringList keys = json_vfm_parameters.keys();
-    for (int i = 0; i < keys.size(); i++)
-        vfm_parameters.insert(std::make_pair(keys.at(i).toStdString(), json_vfm_parameters[keys.at(i)].toDouble()));
+    if (from.empty())
+        throw WobblyException(std::string("Can't ") + operation + ": nothing to " + operation + ".");
 
+    UndoStep step = std::move(from.back());
+    from.pop_back();
 
-    QJsonObject json_vdecimate_parameters = json_project["vdecimate parameters"].toObject();
+    {
+        JournalPause pause(this);
 
-    keys = json_vdecimate_parameters.keys();
-    for (int i = 0; i < keys.size(); i++)
-        vdecimate_parameters.insert(std::make_pair(keys.at(i).toStdString(), json_vdecimate_parameters[keys.at(i)].toDouble()));
+        for (size_t i = step.inverses.size(); i > 0; i--)
+            step.inverses[i - 1]();
+    }
 
+    // The journal can't replay a step it didn't see, so it stops here. The next save writes the whole project.
+    if (journal && !step.in_journal) {
+        journal.reset();
+        journal_stopped = true;
+    }
 
-    QJsonArray json_mics, json_matches, json_original_matches, json_combed_frames, json_decimated_frames, json_decimate_metrics;
+    UndoStep opposite;
+    opposite.inverses.swap(pending_inverses);
+    opposite.in_journal = (bool)journal;
+    to.push_back(std::move(opposite));
 
+    journalRecord(operation);
+}
 
-    json_mics = json_project["mics"].toArray();
-    mics.resize(num_frames[PostSource], { 0 });
-    for (int i = 0; i < json_mics.size(); i++) {
-        QJsonArray json_mic = json_mics[i].toArray();
-        for (int j = 0; j < 5; j++)
-            mics[i][j] = (int16_t)json_mic[j].toDouble();
-    }
 
+bool WobblyProject::canUndo() {
+    return undo_steps.size() || pending_inverses.size();
+}
 
-    json_matches = json_project["matches"].toArray();
-    matches.resize(num_frames[PostSource], 'c');
-    for (int i = 0; i < std::min(json_matches.size(), (int)matches.size()); i++)
-        matches[i] = json_matches[i].toString().toStdString()[0];
 
+bool WobblyProject::canRedo() {
+    return redo_steps.size() && pending_inverses.empty();
+}
 
-    json_original_matches = json_project["original matches"].toArray();
-    original_matches.resize(num_frames[PostSource], 'c');
-    for (int i = 0; i < std::min(json_original_matches.size(), (int)original_matches.size()); i++)
-        original_matches[i] = json_original_matches[i].toString().toStdString()[0];
 
-    if (json_matches.size() == 0 && json_original_matches.size() != 0) {
-        memcpy(matches.data(), original_matches.data(), matches.size());
-    }
+void WobblyProject::undo() {
+    applyUndoStep(undo_steps, redo_steps, "undo");
+}
+
 
+void WobblyProject::redo() {
+    applyUndoStep(redo_steps, undo_steps, "redo");
+}
 
-    json_combed_frames = json_project["combed frames"].toArray();
-    for (int i = 0; i < json_combed_frames.size(); i++)
-        addCombedFrame((int)json_combed_frames[i].toDouble());
 
+int WobblyProject::addChangeListener(const ChangeListener &listener) {
+    int listener_id = next_change_listener_id++;
 
-    decimated_frames.resize((num_frames[PostSource] - 1) / 5 + 1);
-    json_decimated_frames = json_project["decimated frames"].toArray();
-    for (int i = 0; i < json_decimated_frames.size(); i++)
-        addDecimatedFrame((int)json_decimated_frames[i].toDouble());
+    change_listeners.insert(std::make_pair(listener_id, listener));
+
+    return listener_id;
+}
 
-    // num_frames[PostDecimate] is correct at this point.
 
-    json_decimate_metrics = json_project["decimate metrics"].toArray();
-    decimate_metrics.resize(num_frames[PostSource], 0);
-    for (int i = 0; i < std::min(json_decimate_metrics.size(), (int)decimate_metrics.size()); i++)
-        decimate_metrics[i] = (int)json_decimate_metrics[i].toDouble();
+void WobblyProject::removeChangeListener(int listener_id) {
+    change_listeners.erase(listener_id);
+}
 
 
-    QJsonArray json_presets, json_frozen_frames;
+void WobblyProject::notifyChange(ChangeType type, int first, int last) {
+    updateScriptFragments(type, first, last);
 
-    json_presets = json_project["presets"].toArray();
-    for (int i = 0; i < json_presets.size(); i++) {
-        QJsonObject json_preset = json_presets[i].toObject();
-        addPreset(json_preset["name"].toString().toStdString(), json_preset["contents"].toString().toStdString());
-    }
+    for (auto it = change_listeners.cbegin(); it != change_listeners.cend(); it++)
+        it->second(type, first, last);
+}
 
 
-    json_frozen_frames = json_project["frozen frames"].toArray();
-    for (int i = 0; i < json_frozen_frames.size(); i++) {
-        QJsonArray json_ff = json_frozen_frames[i].toArray();
-        addFreezeFrame((int)json_ff[0].toDouble(), (int)json_ff[1].toDouble(), (int)json_ff[2].toDouble());
+void WobblyProject::notifyPresetChange(const PresetReferences &references) {
+    if (references.sections.empty() && references.custom_lists.empty()) {
+        notifyChange(ChangePresets, 0, -1);
+        return;
     }
 
+    for (auto it = references.sections.cbegin(); it != references.sections.cend(); it++)
+        notifyChange(ChangePresets, it->first, getSectionEnd(it->first) - 1);
 
-    QJsonArray json_sections, json_custom_lists;
+    for (auto it = references.custom_lists.cbegin(); it != references.custom_lists.cend(); it++) {
+        const std::map<int, FrameRange> &frames = custom_lists[*it].frames;
 
-    json_sections = json_project["sections"].toArray();
+        for (auto range = frames.cbegin(); range != frames.cend(); range++)
+            notifyChange(ChangePresets, range->second.first, range->second.last);
+    }
+}
 
-    for (int j = 0; j < json_sections.size(); j++) {
-        QJsonObject json_section = json_sections[j].toObject();
-        int section_start = (int)json_section["start"].toDouble();
-        int section_fps_num = (int)json_section["fps_num"].toDouble();
-        int section_fps_den = (int)json_section["fps_den"].toDouble();
-        int section_num_frames = (int)json_section["num_frames"].toDouble();
-        Section section(section_start, section_fps_num, section_fps_den, section_num_frames);
-        json_presets = json_section["presets"].toArray();
-        section.presets.resize(json_presets.size());
-        for (int k = 0; k < json_presets.size(); k++)
-            section.presets[k] = json_presets[k].toString().toStdString();
 
-        addSection(section);
+void WobblyProject::notifyCustomListChange(const CustomList &list) {
+    if (list.frames.empty()) {
+        notifyChange(ChangeCustomLists, 0, -1);
+        return;
     }
 
-    if (json_sections.size() == 0) {
-        addSection(0);
+    for (auto it = list.frames.cbegin(); it != list.frames.cend(); it++)
+        notifyChange(ChangeCustomLists, it->second.first, it->second.last);
+}
+
+
+// Layout of the frame data file: a header, a table of columns, then the columns.
+// Everything is stored in native byte order, which is checked when reading.
+
+#define FRAME_DATA_MAGIC "WOBBLYFD"
+#define FRAME_DATA_VERSION 1
+#define FRAME_DATA_BYTE_ORDER 0x01020304
+
+struct FrameDataHeader {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint32_t num_frames;
+    uint32_t num_columns;
+};
+
+struct FrameDataColumn {
+    uint32_t id;
+    uint32_t element_size;
+    uint64_t offset; // From the start of the file. Multiple of 8.
+    uint64_t count;
+};
+
+enum FrameDataColumnId {
+    FrameDataMics = 0,
+    FrameDataMatches,
+    FrameDataOriginalMatches,
+    FrameDataDecimateMetrics,
+    FrameDataCombedFrames, // Frame numbers.
+    FrameDataDecimatedCycles, // One bitmask per cycle.
+    FrameDataId // The "frame data id" from the project file saved at the same time.
+};
+
+static_assert(sizeof(FrameMetrics::FileMics) == 10, "std::array<int16_t, 5> has padding.");
+
+
+void WobblyProject::writeFrameData(QSaveFile &file, const std::string &id) {
+    // Mapped columns are written straight from the file they were read from. The file keeps
+    // the layout the mics had before they were packed in memory.
+    std::vector<FrameMetrics::FileMics> file_mics;
+    const void *mics_data = metrics->getMappedMics();
+
+    if (!mics_data) {
+        file_mics.resize(num_frames[PostSource]);
+        for (size_t i = 0; i < file_mics.size(); i++)
+            for (int j = 0; j < 5; j++)
+                file_mics[i][j] = metrics->mics[j][i];
+        mics_data = file_mics.data();
     }
 
-    json_custom_lists = json_project["custom lists"].toArray();
+    const void *decimate_metrics_data = metrics->getMappedDecimateMetrics();
+    if (!decimate_metrics_data)
+        decimate_metrics_data = metrics->decimate_metrics.data();
+
+    std::string file_original_matches = original_matches->toString();
+    std::string file_matches = file_original_matches;
+    matches.apply(file_matches, 0);
+
+    std::vector<int32_t> combed;
+    for (int frame = combed_frames->findNext(0); frame != -1; frame = combed_frames->findNext(frame + 1))
+        combed.push_back(frame);
+
+    struct {
+        FrameDataColumnId id;
+        uint32_t element_size;
+        size_t count;
+        const void *data;
+    } columns[] = {
+        { FrameDataMics, sizeof(FrameMetrics::FileMics), (size_t)num_frames[PostSource], mics_data },
+        { FrameDataMatches, 1, file_matches.size(), file_matches.data() },
+        { FrameDataOriginalMatches, 1, file_original_matches.size(), file_original_matches.data() },
+        { FrameDataDecimateMetrics, sizeof(int32_t), (size_t)num_frames[PostSource], decimate_metrics_data },
+        { FrameDataCombedFrames, sizeof(int32_t), combed.size(), combed.data() },
+        { FrameDataDecimatedCycles, 1, decimation->frames.size(), decimation->frames.data() },
+        { FrameDataId, 1, id.size(), id.data() }
+    };
+    const int num_columns = sizeof(columns) / sizeof(columns[0]);
 
-    custom_lists.reserve(json_custom_lists.size());
+    FrameDataHeader header;
+    memcpy(header.magic, FRAME_DATA_MAGIC, sizeof(header.magic));
+    header.byte_order = FRAME_DATA_BYTE_ORDER;
+    header.version = FRAME_DATA_VERSION;
+    header.num_frames = num_frames[PostSource];
+    header.num_columns = num_columns;
 
-    for (int i = 0; i < json_custom_lists.size(); i++) {
-        QJsonObject json_list = json_custom_lists[i].toObject();
+    std::vector<FrameDataColumn> table(num_columns);
 
-        CustomList list(json_list["name"].toString().toStdString(),
-                json_list["preset"].toString().toStdString(),
-                (int)json_list["position"].toDouble());
+    uint64_t offset = sizeof(header) + sizeof(FrameDataColumn) * num_columns;
 
-        QJsonArray json_frames = json_list["frames"].toArray();
-        for (int j = 0; j < json_frames.size(); j++) {
-            QJsonArray json_range = json_frames[j].toArray();
-            list.addFrameRange((int)json_range[0].toDouble(), (int)json_range[1].toDouble());
-        }
+    for (int i = 0; i < num_columns; i++) {
+        table[i].id = columns[i].id;
+        table[i].element_size = columns[i].element_size;
+        table[i].offset = offset;
+        table[i].count = columns[i].count;
 
-        addCustomList(list);
+        offset += (table[i].element_size * table[i].count + 7) & ~(uint64_t)7;
     }
 
+    bool ok = file.write((const char *)&header, sizeof(header)) == sizeof(header);
+    ok = ok && file.write((const char *)table.data(), sizeof(FrameDataColumn) * num_columns) == (qint64)(sizeof(FrameDataColumn) * num_columns);
 
-    QJsonObject json_resize, json_crop;
+    const char padding[8] = { 0 };
 
-    json_resize = json_project["resize"].toObject();
-    resize.enabled = !json_resize.isEmpty();
-    resize.width = (int)json_resize["width"].toDouble(width);
-    resize.height = (int)json_resize["height"].toDouble(height);
+    for (int i = 0; i < num_columns && ok; i++) {
+        qint64 size = table[i].element_size * table[i].count;
+        if (size)
+            ok = file.write((const char *)columns[i].data, size) == size;
+        if (ok && size % 8)
+            ok = file.write(padding, 8 - size % 8) == 8 - size % 8;
+    }
 
-    json_crop = json_project["crop"].toObject();
-    crop.enabled = !json_crop.isEmpty();
-    crop.left = (int)json_crop["left"].toDouble();
-    crop.top = (int)json_crop["top"].toDouble();
-    crop.right = (int)json_crop["right"].toDouble();
-    crop.bottom = (int)json_crop["bottom"].toDouble();
+    if (!ok)
+        throw WobblyException("Failed to write frame data file. Error message: " + file.errorString());
 }
 
-void WobblyProject::addFreezeFrame(int first, int last, int replacement) {
-    if (first > last)
-        std::swap(first, last);
 
-    if (first < 0 || first >= num_frames[PostSource] ||
-        last < 0 || last >= num_frames[PostSource] ||
-        replacement < 0 || replacement >= num_frames[PostSource])
-        throw WobblyException("Can't add FreezeFrame (" + std::to_string(first) + "," + std::to_string(last) + "," + std::to_string(replacement) + "): values out of range.");
+void WobblyProject::readFrameData(const std::string &path, unsigned columns, FrameMetrics &frame_metrics, OriginalMatches &file_original_matches, PackedMatches &full_matches, std::vector<int> &combed, std::vector<int> &decimated) {
+    // The columns that never change are used where they are. Whichever of them is mapped keeps
+    // the file open and mapped. The others are copied, and the file is closed when they're done.
+    std::shared_ptr<QFile> file = std::make_shared<QFile>(QString::fromStdString(path));
 
-    const FreezeFrame *overlap = findFreezeFrame(first);
-    if (!overlap)
-        overlap = findFreezeFrame(last);
-    if (!overlap) {
-        auto it = frozen_frames.upper_bound(first);
-        if (it != frozen_frames.cend() && it->second.first < last)
-            overlap = &it->second;
-    }
+    if (!file->open(QIODevice::ReadOnly))
+        throw WobblyException("Couldn't open frame data file '" + path + "'. Error message: " + file->errorString().toStdString());
 
-    if (overlap)
-        throw WobblyException("Can't add FreezeFrame (" + std::to_string(first) + "," + std::to_string(last) + "," + std::to_string(replacement) + "): overlaps (" + std::to_string(overlap->first) + "," + std::to_string(overlap->last) + "," + std::to_string(overlap->replacement) + ").");
+    qint64 file_size = file->size();
 
-    FreezeFrame ff = {
-        .first = first,
-        .last = last,
-        .replacement = replacement
-    };
-    frozen_frames.insert(std::make_pair(first, ff));
-}
+    if (file_size < (qint64)sizeof(FrameDataHeader))
+        throw WobblyException("Frame data file '" + path + "' is too small.");
 
-void WobblyProject::deleteFreezeFrame(int frame) {
-    frozen_frames.erase(frame);
-}
+    const uint8_t *data = file->map(0, file_size);
+    if (!data)
+        throw WobblyException("Couldn't map frame data file '" + path + "'. Error message: " + file->errorString().toStdString());
 
-const FreezeFrame *WobblyProject::findFreezeFrame(int frame) {
-    if (!frozen_frames.size())
-        return nullptr;
+    FrameDataHeader header;
+    memcpy(&header, data, sizeof(header));
 
-    auto it = frozen_frames.upper_bound(frame);
+    if (memcmp(header.magic, FRAME_DATA_MAGIC, sizeof(header.magic)))
+        throw WobblyException("File '" + path + "' is not a frame data file.");
 
-    it--;
+    if (header.byte_order != FRAME_DATA_BYTE_ORDER)
+        throw WobblyException("Frame data file '" + path + "' was created on a computer with a different byte order.");
 
-    if (it->second.first <= frame && frame <= it->second.last)
-        return &it->second;
+    if (header.version > FRAME_DATA_VERSION)
+        throw WobblyException("Frame data file '" + path + "' was created by a newer version of Wobbly (frame data version " + std::to_string(header.version) + ").");
 
-    return nullptr;
-}
+    if ((int)header.num_frames != num_frames[PostSource])
+        throw WobblyException("Frame data file '" + path + "' contains " + std::to_string(header.num_frames) + " frames, but the project has " + std::to_string(num_frames[PostSource]) + ". It probably belongs to a different project.");
 
+    if ((uint64_t)file_size < sizeof(header) + (uint64_t)header.num_columns * sizeof(FrameDataColumn))
+        throw WobblyException("Frame data file '" + path + "' is truncated.");
 
-void WobblyProject::addPreset(const std::string &preset_name) {
-    std::string contents =
-            "# The preset is a Python function. It takes a single parameter, called 'clip'.\n"
-            "# Filter that and assign the result to the same variable.\n"
-            "# The VapourSynth core object is called 'c'.\n";
-    addPreset(preset_name, contents);
-}
+    std::vector<FrameDataColumn> table(header.num_columns);
+    memcpy(table.data(), data + sizeof(header), header.num_columns * sizeof(FrameDataColumn));
 
+    std::string id;
 
-bool WobblyProject::isNameSafeForPython(const std::string &name) {
-    for (size_t i = 0; i < name.size(); i++) {
-        const char &c = name[i];
+    for (uint32_t i = 0; i < header.num_columns; i++) {
+        uint64_t size = table[i].element_size * table[i].count;
 
-        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (i && c >= '0' && c <= '9') || c == '_'))
-            return false;
+        if (table[i].offset > (uint64_t)file_size || size > (uint64_t)file_size - table[i].offset)
+            throw WobblyException("Frame data file '" + path + "' is truncated.");
+
+        if (table[i].id == FrameDataId && table[i].element_size == 1)
+            id.assign((const char *)data + table[i].offset, table[i].count);
     }
 
-    return true;
-}
+    // A project file and a frame data file from different saves must not be mixed.
+    if (id != frame_data_id)
+        throw WobblyException("Frame data file '" + path + "' wasn't saved together with the project file. Perhaps saving the project failed halfway.");
 
-void WobblyProject::addPreset(const std::string &preset_name, const std::string &preset_contents) {
-    if (!isNameSafeForPython(preset_name))
-        throw WobblyException("Can't add preset '" + preset_name + "': name is invalid. Use only letters, numbers, and the underscore character. The first character cannot be a number.");
+    for (uint32_t i = 0; i < header.num_columns; i++) {
+        const FrameDataColumn &column = table[i];
 
-    Preset preset;
-    preset.name = preset_name;
-    preset.contents = preset_contents;
-    presets.insert(std::make_pair(preset_name, preset));
-}
+        uint64_t size = column.element_size * column.count;
 
-void WobblyProject::renamePreset(const std::string &old_name, const std::string &new_name) {
-    if (!presets.count(old_name))
-        throw WobblyException("Can't rename preset '" + old_name + "' to '" + new_name + "': no such preset.");
+        const uint8_t *column_data = data + column.offset;
 
-    if (!isNameSafeForPython(new_name))
-        throw WobblyException("Can't rename preset '" + old_name + "' to '" + new_name + "': new name is invalid. Use only letters, numbers, and the underscore character. The first character cannot be a number.");
+        if (column.id < 32 && !(columns & (1u << column.id)))
+            continue;
 
-    Preset preset;
-    preset.name = new_name;
-    preset.contents = presets.at(old_name).contents;
+        // Only columns with a value for every frame can be used in place.
+        bool complete = column.count == header.num_frames;
 
-    presets.erase(old_name);
-    presets.insert(std::make_pair(new_name, preset));
+        // Columns with unknown ids are skipped, so older versions can read newer files if the version number allows it.
+        if (column.id == FrameDataMics && column.element_size == sizeof(FrameMetrics::FileMics)) {
+            if (complete) {
+                frame_metrics.mapMics(file, (const char *)column_data);
+                continue;
+            }
 
-    for (auto it = sections.begin(); it != sections.end(); it++)
-        for (size_t j = 0; j < it->second.presets.size(); j++)
-            if (it->second.presets[j] == old_name)
-                it->second.presets[j] = new_name;
+            for (int j = 0; j < 5; j++) {
+                frame_metrics.mics[j].resize(column.count);
+                for (uint64_t frame = 0; frame < column.count; frame++)
+                    memcpy(&frame_metrics.mics[j][frame], column_data + frame * column.element_size + j * sizeof(int16_t), sizeof(int16_t));
+            }
+        } else if (column.id == FrameDataMatches && column.element_size == 1) {
+            full_matches.assign((const char *)column_data, column.count);
+        } else if (column.id == FrameDataOriginalMatches && column.element_size == 1) {
+            if (complete)
+                file_original_matches.map(file, (const char *)column_data, column.count);
+            else
+                file_original_matches.assign((const char *)column_data, column.count);
+        } else if (column.id == FrameDataDecimateMetrics && column.element_size == sizeof(int32_t)) {
+            if (complete && column.offset % sizeof(int32_t) == 0) {
+                frame_metrics.mapDecimateMetrics(file, (const int32_t *)column_data);
+                continue;
+            }
 
-    for (auto it = custom_lists.begin(); it != custom_lists.end(); it++)
-        if (it->preset == old_name)
-            it->preset = new_name;
+            frame_metrics.decimate_metrics.resize(column.count);
+            memcpy(frame_metrics.decimate_metrics.data(), column_data, size);
+        } else if (column.id == FrameDataCombedFrames && column.element_size == sizeof(int32_t)) {
+            combed.resize(column.count);
+            memcpy(combed.data(), column_data, size);
+        } else if (column.id == FrameDataDecimatedCycles && column.element_size == 1) {
+            for (uint64_t cycle = 0; cycle < column.count; cycle++)
+                for (int j = 0; j < 5; j++)
+                    if (column_data[cycle] & (1 << j))
+                        decimated.push_back((int)cycle * 5 + j);
+        }
+    }
 }
 
-void WobblyProject::deletePreset(const std::string &preset_name) {
-    if (presets.erase(preset_name) == 0)
-        throw WobblyException("Can't delete preset '" + preset_name + "': no such preset.");
 
-    for (auto it = sections.begin(); it != sections.end(); it++)
-        for (size_t j = 0; j < it->second.presets.size(); j++)
-            if (it->second.presets[j] == preset_name)
-                it->second.presets.erase(it->second.presets.cbegin() + j);
+// Returns the contents of the file, mapped if possible. They stay valid while file and copy exist.
+static const char *mapProjectFile(QFile &file, QByteArray &copy, qint64 &size) {
+    size = file.size();
 
-    for (auto it = custom_lists.begin(); it != custom_lists.end(); it++)
-        if (it->preset == preset_name)
-            it->preset.clear();
+    const char *data = nullptr;
+    if (size > 0)
+        data = (const char *)file.map(0, size);
+
+    if (!data) {
+        copy = file.readAll();
+        data = copy.constData();
+        size = copy.size();
+    }
+
+    return data;
 }
 
-const std::string &WobblyProject::getPresetContents(const std::string &preset_name) {
-    if (!presets.count(preset_name))
-        throw WobblyException("Can't retrieve the contents of preset '" + preset_name + "': no such preset.");
 
-    const Preset &preset = presets.at(preset_name);
-    return preset.contents;
+static void readMics(JsonReader &json, std::array<std::vector<int16_t>, 5> &mics) {
+    json.beginArray();
+    while (json.nextElement()) {
+        std::array<int16_t, 5> mic = { 0 };
+        json.beginArray();
+        for (int i = 0; json.nextElement(); i++) {
+            if (i < 5)
+                mic[i] = (int16_t)json.readInt();
+            else
+                json.skipValue();
+        }
+        for (int i = 0; i < 5; i++)
+            mics[i].push_back(mic[i]);
+    }
 }
 
-void WobblyProject::setPresetContents(const std::string &preset_name, const std::string &preset_contents) {
-    if (!presets.count(preset_name))
-        throw WobblyException("Can't modify the contents of preset '" + preset_name + "': no such preset.");
 
-    Preset &preset = presets.at(preset_name);
-    preset.contents = preset_contents;
+static void readDecimateMetrics(JsonReader &json, std::vector<int> &decimate_metrics) {
+    json.beginArray();
+    while (json.nextElement())
+        decimate_metrics.push_back((int)json.readInt());
 }
 
-void WobblyProject::assignPresetToSection(const std::string &preset_name, int section_start) {
-    // The user may want to assign the same preset twice.
-    sections.at(section_start).presets.push_back(preset_name);
+
+// Into PackedMatches or OriginalMatches.
+template <typename Matches>
+static void readMatches(JsonReader &json, Matches &matches) {
+    std::string value;
+
+    if (json.isString()) {
+        json.readString(value);
+    } else {
+        // Format version 1: one string per frame.
+        std::string match;
+        json.beginArray();
+        while (json.nextElement()) {
+            json.readString(match);
+            value += match[0];
+        }
+    }
+
+    matches.assign(value.data(), value.size());
 }
 
 
-void WobblyProject::setMatch(int frame, char match) {
-    matches[frame] = match;
+// Format version 3: [first, last, pattern], where pattern[0] is the match of frame first.
+static void readMatchOverrides(JsonReader &json, MatchOverrides &matches) {
+    json.beginArray();
+    while (json.nextElement()) {
+        int range[2] = { 0, -1 };
+        std::string pattern;
+        json.beginArray();
+        for (int i = 0; json.nextElement(); i++) {
+            if (i < 2)
+                range[i] = (int)json.readInt();
+            else if (i == 2)
+                json.readString(pattern);
+            else
+                json.skipValue();
+        }
+        matches.setPattern(range[0], range[1], range[0], pattern);
+    }
 }
 
 
-void WobblyProject::addSection(int section_start) {
-    Section section(section_start);
-    addSection(section);
+static void readFrameList(JsonReader &json, std::vector<int> &frames) {
+    json.beginArray();
+    while (json.nextElement())
+        frames.push_back((int)json.readInt());
 }
 
-void WobblyProject::addSection(const Section &section) {
-    if (section.start < 0 || section.start >= num_frames[PostSource])
-        throw WobblyException("Can't add section starting at " + std::to_string(section.start) + ": value out of range.");
 
-    sections.insert(std::make_pair(section.start, section));
+static void readCombedRanges(JsonReader &json, std::vector<int> &frames) {
+    json.beginArray();
+    while (json.nextElement()) {
+        int range[2] = { 0, -1 };
+        json.beginArray();
+        for (int i = 0; json.nextElement(); i++) {
+            if (i < 2)
+                range[i] = (int)json.readInt();
+            else
+                json.skipValue();
+        }
+        for (int i = range[0]; i <= range[1]; i++)
+            frames.push_back(i);
+    }
 }
 
-void WobblyProject::deleteSection(int section_start) {
-    // Never delete the very first section.
-    if (section_start > 0)
-        sections.erase(section_start);
+
+static void readDecimatedCycles(JsonReader &json, std::vector<int> &frames) {
+    int cycle = 0;
+    json.beginArray();
+    while (json.nextElement()) {
+        int run[2] = { 0, 0 };
+        json.beginArray();
+        for (int i = 0; json.nextElement(); i++) {
+            if (i < 2)
+                run[i] = (int)json.readInt();
+            else
+                json.skipValue();
+        }
+        for (int i = 0; i < run[1]; i++, cycle++)
+            for (int j = 0; j < 5; j++)
+                if (run[0] & (1 << j))
+                    frames.push_back(cycle * 5 + j);
+    }
 }
 
-const Section *WobblyProject::findSection(int frame) {
-    auto it = sections.upper_bound(frame);
-    it--;
-    return &it->second;
+
+// The presets are returned separately, as names. They only get ids once they are added to the project.
+static void readCustomLists(JsonReader &json, std::vector<CustomList> &custom_lists, std::vector<std::string> &list_presets) {
+    std::string key;
+
+    json.beginArray();
+    while (json.nextElement()) {
+        CustomList list("");
+        std::string preset;
+        json.beginObject();
+        while (json.nextKey(key)) {
+            if (key == "name") {
+                list.name = json.readString();
+            } else if (key == "preset") {
+                preset = json.readString();
+            } else if (key == "position") {
+                list.position = (int)json.readInt();
+            } else if (key == "frames") {
+                json.beginArray();
+                while (json.nextElement()) {
+                    int range[2] = { 0, 0 };
+                    json.beginArray();
+                    for (int i = 0; json.nextElement(); i++) {
+                        if (i < 2)
+                            range[i] = (int)json.readInt();
+                        else
+                            json.skipValue();
+                    }
+                    list.addFrameRange(range[0], range[1]);
+                }
+            } else {
+                json.skipValue();
+            }
+        }
+        custom_lists.push_back(list);
+        list_presets.push_back(preset);
+    }
 }
 
-const Section *WobblyProject::findNextSection(int frame) {
-    auto it = sections.upper_bound(frame);
 
-    if (it != sections.cend())
-        return &it->second;
+void WobblyProject::loadMetrics() {
+    std::shared_ptr<FrameMetrics> new_metrics = std::make_shared<FrameMetrics>();
 
-    return nullptr;
-}
+    if (metrics_in_frame_data_file) {
+        OriginalMatches unused_original_matches;
+        PackedMatches unused_matches;
+        std::vector<int> unused;
+        readFrameData(metrics_path, (1u << FrameDataMics) | (1u << FrameDataDecimateMetrics), *new_metrics, unused_original_matches, unused_matches, unused, unused);
+    } else if (mics_offset >= 0 || decimate_metrics_offset >= 0) {
+        QFile file(QString::fromStdString(metrics_path));
 
-int WobblyProject::getSectionEnd(int frame) {
-    const Section *next_section = findNextSection(frame);
-    if (next_section)
-        return next_section->start;
-    else
-        return num_frames[PostSource];
-}
+        if (!file.open(QIODevice::ReadOnly))
+            throw WobblyException("Couldn't open project file '" + metrics_path + "' to read the metrics. Error message: " + file.errorString().toStdString());
 
-void WobblyProject::setSectionMatchesFromPattern(int section_start, const std::string &pattern) {
-    int section_end = getSectionEnd(section_start);
+        QByteArray data_copy;
+        qint64 data_size;
+        const char *data = mapProjectFile(file, data_copy, data_size);
 
-    for (int i = 0; i < section_end - section_start; i++) {
-        if ((section_start + i == 0 && (pattern[i % 5] == 'p' || pattern[i % 5] == 'b')) ||
-            (section_start + i == num_frames[PostSource] - 1 && (pattern[i % 5] == 'n' || pattern[i % 5] == 'u')))
-            // Skip the first and last frame if their new matches are incompatible.
-            continue;
+        int64_t offsets[2] = { mics_offset, decimate_metrics_offset };
 
-        // Yatta does it like this.
-        matches[section_start + i] = pattern[i % 5];
+        for (int i = 0; i < 2; i++) {
+            if (offsets[i] < 0)
+                continue;
+
+            if (offsets[i] >= data_size)
+                throw WobblyException("Couldn't read the metrics from project file '" + metrics_path + "': the file was modified after it was opened.");
+
+            JsonReader json(data, data_size, offsets[i]);
+            if (i == 0)
+                readMics(json, new_metrics->mics);
+            else
+                readDecimateMetrics(json, new_metrics->decimate_metrics);
+        }
     }
+
+    new_metrics->resize(num_frames[PostSource]);
+
+    metrics = new_metrics;
 }
 
-void WobblyProject::setSectionDecimationFromPattern(int section_start, const std::string &pattern) {
-    int section_end = getSectionEnd(section_start);
 
-    for (int i = 0; i < section_end - section_start; i++) {
-        // Yatta does it like this.
-        if (pattern[i % 5] == 'd')
-            addDecimatedFrame(section_start + i);
-        else
-            deleteDecimatedFrame(section_start + i);
+void WobblyProject::mapFrameData(const std::string &path) {
+    std::shared_ptr<FrameMetrics> new_metrics = std::make_shared<FrameMetrics>();
+    std::shared_ptr<OriginalMatches> new_original_matches = std::make_shared<OriginalMatches>();
+    PackedMatches unused_matches;
+    std::vector<int> unused;
+
+    readFrameData(path, (1u << FrameDataMics) | (1u << FrameDataOriginalMatches) | (1u << FrameDataDecimateMetrics), *new_metrics, *new_original_matches, unused_matches, unused, unused);
+
+    // Otherwise the columns in memory are just as good.
+    if (new_metrics->getMappedMics() && new_metrics->getMappedDecimateMetrics() && new_original_matches->isMapped()) {
+        metrics = new_metrics;
+        original_matches = new_original_matches;
+        frame_data_mapping_path = path;
     }
 }
 
 
-void WobblyProject::resetRangeMatches(int start, int end) {
-    if (start > end)
-        std::swap(start, end);
+void WobblyProject::unmapFrameData() {
+    if (metrics && (metrics->getMappedMics() || metrics->getMappedDecimateMetrics())) {
+        std::shared_ptr<FrameMetrics> new_metrics = std::make_shared<FrameMetrics>();
 
-    if (start < 0 || end >= num_frames[PostSource])
-        throw WobblyException("Can't reset the matches for range [" + std::to_string(start) + "," + std::to_string(end) + "]: values out of range.");
+        for (int i = 0; i < 5; i++) {
+            new_metrics->mics[i].resize(num_frames[PostSource]);
+            for (int frame = 0; frame < num_frames[PostSource]; frame++)
+                new_metrics->mics[i][frame] = metrics->getMic(frame, i);
+        }
 
-    memcpy(matches.data() + start, original_matches.data() + start, end - start + 1);
-}
+        new_metrics->decimate_metrics.resize(num_frames[PostSource]);
+        for (int frame = 0; frame < num_frames[PostSource]; frame++)
+            new_metrics->decimate_metrics[frame] = metrics->getDecimateMetric(frame);
 
+        metrics = new_metrics;
+    }
 
-void WobblyProject::resetSectionMatches(int section_start) {
-    int section_end = getSectionEnd(section_start);
+    if (original_matches->isMapped()) {
+        std::shared_ptr<OriginalMatches> new_original_matches = std::make_shared<OriginalMatches>();
+        std::string matches_string = original_matches->toString();
+        new_original_matches->assign(matches_string.data(), matches_string.size());
 
-    resetRangeMatches(section_start, section_end - 1);
+        original_matches = new_original_matches;
+    }
+
+    frame_data_mapping_path.clear();
 }
 
 
-void WobblyProject::addCustomList(const std::string &list_name) {
-    CustomList list(list_name);
-    addCustomList(list);
+// 16 random hexadecimal digits.
+static std::string randomId() {
+    std::random_device random;
+    char id[17];
+    snprintf(id, sizeof(id), "%08x%08x", (unsigned)random(), (unsigned)random());
+    return id;
 }
 
-void WobblyProject::addCustomList(const CustomList &list) {
-    if (list.position < 0 || list.position >= 3)
-        throw WobblyException("Can't add custom list '" + list.name + "' with position " + std::to_string(list.position) + ": position out of range.");
 
-    if (!isNameSafeForPython(list.name))
-        throw WobblyException("Can't add custom list '" + list.name + "': name is invalid. Use only letters, numbers, and the underscore character. The first character cannot be a number.");
+// Sorted by name, like QJsonObject did, so saving the same project twice gives the same file.
+static void writeParameters(JsonWriter &json, const std::unordered_map<std::string, double> &parameters) {
+    std::map<std::string, double> sorted(parameters.cbegin(), parameters.cend());
+
+    json.beginObject();
+    for (auto it = sorted.cbegin(); it != sorted.cend(); it++) {
+        json.writeKey(it->first);
+        json.writeDouble(it->second);
+    }
+    json.endObject();
+}
 
-    if (list.preset.size() && presets.count(list.preset) == 0)
-        throw WobblyException("Can't add custom list '" + list.name + "' with preset '" + list.preset + "': no such preset.");
 
-    for (size_t i = 0; i < custom_lists.size(); i++)
-        if (custom_lists[i].name == list.name)
-            throw WobblyException("Can't add custom list '" + list.name + "': a list with this name already exists.");
+void WobblyProject::writeProject(const std::string &path) {
+    if (!metrics)
+        loadMetrics();
+
+    // QSaveFile writes to a temporary file and only replaces the project file in commit(),
+    // so a crash or a failed write can't leave a half-written project behind.
+    QSaveFile file(QString::fromStdString(path));
+
+    if (!file.open(QIODevice::WriteOnly))
+        throw WobblyException("Couldn't open project file. Error message: " + file.errorString());
+
+    JsonWriter json(&file);
+
+    json.beginObject();
+
+    json.writeKey("wibbly wobbly version");
+    json.writeInt(PROJECT_FORMAT_VERSION);
+
+
+    json.writeKey("input file");
+    json.writeString(input_file);
+
+
+    std::string new_journal_id;
+
+    if (journal_enabled) {
+        new_journal_id = randomId();
+
+        json.writeKey("journal id");
+        json.writeString(new_journal_id);
+    }
+
+
+    json.writeKey("input frame rate");
+    json.beginArray(true);
+    json.writeInt(fps_num);
+    json.writeInt(fps_den);
+    json.endArray();
+
+
+    json.writeKey("input resolution");
+    json.beginArray(true);
+    json.writeInt(width);
+    json.writeInt(height);
+    json.endArray();
+
+
+    json.writeKey("trim");
+    json.beginArray();
+    for (auto it = trims.cbegin(); it != trims.cend(); it++) {
+        json.beginArray(true);
+        json.writeInt(it->second.first);
+        json.writeInt(it->second.last);
+        json.endArray();
+    }
+    json.endArray();
+
+
+    json.writeKey("vfm parameters");
+    writeParameters(json, vfm_parameters);
+
+
+    json.writeKey("vdecimate parameters");
+    writeParameters(json, vdecimate_parameters);
+
+
+    // Like the project file, it's only replaced after everything was written.
+    std::unique_ptr<QSaveFile> frame_data_file;
+    std::string new_frame_data_id;
+
+    if (frame_data_file_enabled) {
+        // The per-frame arrays go in a binary file next to the project.
+        std::string frame_data_path = path + ".frames";
+
+        frame_data_file.reset(new QSaveFile(QString::fromStdString(frame_data_path)));
+
+        if (!frame_data_file->open(QIODevice::WriteOnly))
+            throw WobblyException("Couldn't open frame data file. Error message: " + frame_data_file->errorString());
+
+        new_frame_data_id = randomId();
+
+        writeFrameData(*frame_data_file, new_frame_data_id);
+
+        json.writeKey("frame data file");
+        json.writeString(QFileInfo(QString::fromStdString(frame_data_path)).fileName().toStdString());
+
+        json.writeKey("frame data id");
+        json.writeString(new_frame_data_id);
+    } else {
+        json.writeKey("mics");
+        json.beginArray();
+        for (int i = 0; i < num_frames[PostSource]; i++) {
+            json.beginArray(true);
+            for (int j = 0; j < 5; j++)
+                json.writeInt(metrics->getMic(i, j));
+            json.endArray();
+        }
+        json.endArray();
+
+
+        // One character per frame.
+        json.writeKey("original matches");
+        json.writeString(original_matches->toString());
+
+
+        // Only the frames that differ from the original matches: [first, last, pattern].
+        json.writeKey("match overrides");
+        json.beginArray();
+        for (auto it = matches.getRuns().cbegin(); it != matches.getRuns().cend(); it++) {
+            const MatchRun &run = it->second;
+
+            std::string pattern;
+            for (int i = 0; i < run.length; i++)
+                pattern += run.get(run.first + i);
+
+            json.beginArray(true);
+            json.writeInt(run.first);
+            json.writeInt(run.last);
+            json.writeString(pattern);
+            json.endArray();
+        }
+        json.endArray();
+
+
+        // Ranges of consecutive combed frames: [first, last].
+        json.writeKey("combed ranges");
+        json.beginArray(true);
+        for (int first = combed_frames->findNext(0); first != -1; ) {
+            int last = first;
+
+            while (last + 1 < (int)combed_frames->size() && combed_frames->test(last + 1))
+                last++;
+
+            json.beginArray(true);
+            json.writeInt(first);
+            json.writeInt(last);
+            json.endArray();
+
+            first = combed_frames->findNext(last + 1);
+        }
+        json.endArray();
+
+
+        // Runs of cycles with the same decimated frames: [bitmask, number of cycles].
+        json.writeKey("decimated cycles");
+        json.beginArray(true);
+        const std::vector<uint8_t> &cycles = decimation->frames;
+
+        for (size_t i = 0; i < cycles.size(); ) {
+            int mask = cycles[i];
+            int run = 1;
+
+            for (i++; i < cycles.size() && cycles[i] == mask; i++)
+                run++;
+
+            json.beginArray(true);
+            json.writeInt(mask);
+            json.writeInt(run);
+            json.endArray();
+        }
+        json.endArray();
+
+
+        json.writeKey("decimate metrics");
+        json.beginArray(true);
+        for (int i = 0; i < num_frames[PostSource]; i++)
+            json.writeInt(metrics->getDecimateMetric(i));
+        json.endArray();
+    }
+
+
+    json.writeKey("sections");
+    json.beginArray();
+    for (auto it = sections.cbegin(); it != sections.cend(); it++) {
+        json.beginObject();
+        json.writeKey("start");
+        json.writeInt(it->second.start);
+        json.writeKey("presets");
+        json.beginArray(true);
+        for (size_t i = 0; i < it->second.presets.size(); i++)
+            json.writeString(preset_names[it->second.presets[i]]);
+        json.endArray();
+        json.writeKey("fps_num");
+        json.writeInt(it->second.fps_num);
+        json.writeKey("fps_den");
+        json.writeInt(it->second.fps_den);
+        json.writeKey("num_frames");
+        json.writeInt(it->second.num_frames);
+        json.endObject();
+    }
+    json.endArray();
+
+
+    if (is_wobbly) {
+        json.writeKey("presets");
+        json.beginArray();
+        for (auto it = presets.cbegin(); it != presets.cend(); it++) {
+            json.beginObject();
+            json.writeKey("name");
+            json.writeString(it->second.name);
+            json.writeKey("contents");
+            json.writeString(it->second.contents);
+            json.endObject();
+        }
+        json.endArray();
+
+
+        json.writeKey("frozen frames");
+        json.beginArray();
+        for (auto it = frozen_frames.cbegin(); it != frozen_frames.cend(); it++) {
+            json.beginArray(true);
+            json.writeInt(it->second.first);
+            json.writeInt(it->second.last);
+            json.writeInt(it->second.replacement);
+            json.endArray();
+        }
+        json.endArray();
+
+
+        json.writeKey("custom lists");
+        json.beginArray();
+        for (size_t i = 0; i < custom_lists.size(); i++) {
+            json.beginObject();
+            json.writeKey("name");
+            json.writeString(custom_lists[i].name);
+            json.writeKey("preset");
+            json.writeString(custom_lists[i].preset != -1 ? preset_names[custom_lists[i].preset] : std::string());
+            json.writeKey("position");
+            json.writeInt(custom_lists[i].position);
+            json.writeKey("frames");
+            json.beginArray(true);
+            for (auto it = custom_lists[i].frames.cbegin(); it != custom_lists[i].frames.cend(); it++) {
+                json.beginArray(true);
+                json.writeInt(it->second.first);
+                json.writeInt(it->second.last);
+                json.endArray();
+            }
+            json.endArray();
+            json.endObject();
+        }
+        json.endArray();
+
+
+        if (resize.enabled) {
+            json.writeKey("resize");
+            json.beginObject();
+            json.writeKey("width");
+            json.writeInt(resize.width);
+            json.writeKey("height");
+            json.writeInt(resize.height);
+            json.endObject();
+        }
+
+        if (crop.enabled) {
+            json.writeKey("crop");
+            json.beginObject();
+            json.writeKey("left");
+            json.writeInt(crop.left);
+            json.writeKey("top");
+            json.writeInt(crop.top);
+            json.writeKey("right");
+            json.writeInt(crop.right);
+            json.writeKey("bottom");
+            json.writeInt(crop.bottom);
+            json.endObject();
+        }
+    }
+
+    json.endObject();
+
+    json.flush();
+
+    // Windows can't replace a mapped file. The columns mapped from it move to memory first.
+    if (frame_data_file && !frame_data_mapping_path.empty() && QFileInfo(frame_data_file->fileName()) == QFileInfo(QString::fromStdString(frame_data_mapping_path)))
+        unmapFrameData();
+
+    // The project file is replaced last. If anything goes wrong in between, the old project
+    // file doesn't have the new frame data file's id, and readProject refuses the pair.
+    if (frame_data_file && !frame_data_file->commit())
+        throw WobblyException("Couldn't save frame data file. Error message: " + frame_data_file->errorString());
+
+    if (!file.commit())
+        throw WobblyException("Couldn't save project file. Error message: " + file.errorString());
+
+    frame_data_id = new_frame_data_id;
+
+    // The autosave's journal id is only there to keep the journal enabled when it's recovered.
+    if (is_snapshot)
+        return;
+
+    if (frame_data_file) {
+        try {
+            mapFrameData(frame_data_file->fileName().toStdString());
+        } catch (WobblyException &) {
+            // The columns in memory are just as good.
+        }
+    }
+
+    // The journal's changes are in the project file now. If the project was saved under
+    // a different name, its old file must stay the way it was when it was last saved.
+    if (journal && journal->getPath() != path + ".journal")
+        journal->rollback();
+    journal.reset();
+
+    project_path = path;
+    journal_id = new_journal_id;
+    journal_recovered_records = 0;
+    journal_stopped = false;
+
+    // The new journal starts from here, so it can't replay undoing or redoing anything older.
+    for (size_t i = 0; i < undo_steps.size(); i++)
+        undo_steps[i].in_journal = false;
+    for (size_t i = 0; i < redo_steps.size(); i++)
+        redo_steps[i].in_journal = false;
+
+    if (journal_enabled) {
+        journal = std::make_shared<ProjectJournal>(path + ".journal");
+        journal->create(journal_id);
+    } else {
+        QFile::remove(QString::fromStdString(path + ".journal"));
+    }
+}
+
+
+void WobblyProject::saveProject(const std::string &path) {
+    // Past this size, replaying the journal takes longer than reading a new project file would.
+    const qint64 journal_compaction_threshold = 4 << 20;
+
+    if (journal_enabled && journal && path == project_path && journal->size() < journal_compaction_threshold) {
+        journal->commit();
+        journal_recovered_records = 0;
+        return;
+    }
+
+    writeProject(path);
+}
+
+
+void WobblyProject::setJournalEnabled(bool enabled) {
+    journal_enabled = enabled;
+}
+
+
+bool WobblyProject::isJournalEnabled() {
+    return journal_enabled;
+}
+
+
+void WobblyProject::rollbackJournal() {
+    if (journal)
+        journal->rollback();
+}
+
+
+int WobblyProject::getRecoveredJournalRecords() {
+    return journal_recovered_records;
+}
+
+
+bool WobblyProject::isJournalStopped() {
+    return journal_stopped;
+}
+
+
+bool WobblyProject::replayJournal(const std::string &journal_path, qint64 &valid_size, qint64 &committed_size) {
+    QFile file(QString::fromStdString(journal_path));
+
+    if (!file.open(QIODevice::ReadOnly))
+        throw WobblyException("Couldn't open journal file '" + journal_path + "'. Error message: " + file.errorString().toStdString());
+
+    QByteArray data = file.readAll();
+
+    const char *start = data.constData();
+    const char *end = start + data.size();
+
+    valid_size = 0;
+    committed_size = 0;
+
+    JournalPause pause(this);
+
+    std::string operation;
+
+    int record = 0;
+
+    for (const char *line = start; line < end; record++) {
+        const char *line_end = (const char *)memchr(line, '\n', end - line);
+
+        // A record without its newline is one that was being written when Wobbly crashed.
+        if (!line_end)
+            break;
+        line_end++;
+
+        try {
+            JsonReader json(line, line_end - line);
+            json.beginArray();
+            if (!json.nextElement())
+                throw WobblyException("empty record.");
+            json.readString(operation);
+
+            if (record == 0) {
+                // The journal belongs to an older version of the project file.
+                if (operation != "base" || !json.nextElement() || json.readString() != journal_id)
+                    return false;
+            } else if (operation == "commit") {
+                committed_size = line_end - start;
+                journal_recovered_records = 0;
+            } else {
+                applyJournalRecord(operation, json);
+                finishUndoStep();
+                journal_recovered_records++;
+            }
+        } catch (WobblyException &e) {
+            throw WobblyException("Failed to replay record " + std::to_string(record) + " from journal file '" + journal_path + "': " + e.what() + " Delete the journal file to open the project without the changes it contains.");
+        }
+
+        valid_size = line_end - start;
+        if (record == 0)
+            committed_size = valid_size;
+
+        line = line_end;
+    }
+
+    return valid_size > 0;
+}
+
+
+void WobblyProject::applyJournalRecord(const std::string &operation, JsonReader &json) {
+    // The arguments must be read in order, so they are never read directly in a function call's argument list.
+    auto nextArgument = [&json] () {
+        if (!json.nextElement())
+            throw WobblyException("missing argument.");
+    };
+    auto nextInt = [&] () -> int {
+        nextArgument();
+        return (int)json.readInt();
+    };
+    auto nextString = [&] () -> std::string {
+        nextArgument();
+        return json.readString();
+    };
+    auto nextBool = [&] () -> bool {
+        nextArgument();
+        return json.readBool();
+    };
+
+    if (operation == "setMatch") {
+        int frame = nextInt();
+        std::string match = nextString();
+        setMatch(frame, match[0]);
+    } else if (operation == "addFreezeFrame") {
+        int first = nextInt();
+        int last = nextInt();
+        int replacement = nextInt();
+        addFreezeFrame(first, last, replacement);
+    } else if (operation == "deleteFreezeFrame") {
+        deleteFreezeFrame(nextInt());
+    } else if (operation == "addPreset") {
+        std::string name = nextString();
+        std::string contents = nextString();
+        addPreset(name, contents);
+    } else if (operation == "renamePreset") {
+        std::string old_name = nextString();
+        std::string new_name = nextString();
+        renamePreset(old_name, new_name);
+    } else if (operation == "deletePreset") {
+        deletePreset(nextString());
+    } else if (operation == "setPresetContents") {
+        std::string name = nextString();
+        std::string contents = nextString();
+        setPresetContents(name, contents);
+    } else if (operation == "assignPresetToSection") {
+        std::string name = nextString();
+        int section_start = nextInt();
+        assignPresetToSection(name, section_start);
+    } else if (operation == "addSection") {
+        Section section(nextInt());
+        nextArgument();
+        json.beginArray();
+        while (json.nextElement())
+            section.presets.push_back(getPresetId(json.readString()));
+        section.fps_num = nextInt();
+        section.fps_den = nextInt();
+        section.num_frames = nextInt();
+        addSection(section);
+    } else if (operation == "deleteSection") {
+        deleteSection(nextInt());
+    } else if (operation == "setSectionMatchesFromPattern") {
+        int section_start = nextInt();
+        std::string pattern = nextString();
+        setSectionMatchesFromPattern(section_start, pattern);
+    } else if (operation == "setSectionDecimationFromPattern") {
+        int section_start = nextInt();
+        std::string pattern = nextString();
+        setSectionDecimationFromPattern(section_start, pattern);
+    } else if (operation == "setRangeMatchesFromPattern") {
+        int start = nextInt();
+        int end = nextInt();
+        std::string pattern = nextString();
+        setRangeMatchesFromPattern(start, end, pattern);
+    } else if (operation == "setRangeDecimationFromPattern") {
+        int start = nextInt();
+        int end = nextInt();
+        std::string pattern = nextString();
+        setRangeDecimationFromPattern(start, end, pattern);
+    } else if (operation == "resetRangeMatches") {
+        int start = nextInt();
+        int end = nextInt();
+        resetRangeMatches(start, end);
+    } else if (operation == "addCustomList") {
+        std::string name = nextString();
+        std::string preset = nextString();
+        int position = nextInt();
+        CustomList list(name, preset.size() ? getPresetId(preset) : -1, position);
+        nextArgument();
+        json.beginArray();
+        while (json.nextElement()) {
+            json.beginArray();
+            int range[2];
+            for (int i = 0; i < 2; i++) {
+                if (!json.nextElement())
+                    throw WobblyException("missing argument.");
+                range[i] = (int)json.readInt();
+            }
+            while (json.nextElement())
+                json.skipValue();
+            list.addFrameRange(range[0], range[1]);
+        }
+        addCustomList(list);
+    } else if (operation == "deleteCustomList") {
+        deleteCustomList(nextInt());
+    } else if (operation == "addDecimatedFrame") {
+        addDecimatedFrame(nextInt());
+    } else if (operation == "deleteDecimatedFrame") {
+        deleteDecimatedFrame(nextInt());
+    } else if (operation == "clearDecimatedFramesFromCycle") {
+        clearDecimatedFramesFromCycle(nextInt());
+    } else if (operation == "clearDecimatedFramesFromRange") {
+        int start = nextInt();
+        int end = nextInt();
+        clearDecimatedFramesFromRange(start, end);
+    } else if (operation == "addCombedFrame") {
+        addCombedFrame(nextInt());
+    } else if (operation == "deleteCombedFrame") {
+        deleteCombedFrame(nextInt());
+    } else if (operation == "addCombedRange") {
+        int start = nextInt();
+        int end = nextInt();
+        addCombedRange(start, end);
+    } else if (operation == "deleteCombedRange") {
+        int start = nextInt();
+        int end = nextInt();
+        deleteCombedRange(start, end);
+    } else if (operation == "setResize") {
+        int new_width = nextInt();
+        int new_height = nextInt();
+        setResize(new_width, new_height);
+    } else if (operation == "setResizeEnabled") {
+        setResizeEnabled(nextBool());
+    } else if (operation == "setCrop") {
+        int left = nextInt();
+        int top = nextInt();
+        int right = nextInt();
+        int bottom = nextInt();
+        setCrop(left, top, right, bottom);
+    } else if (operation == "setCropEnabled") {
+        setCropEnabled(nextBool());
+    } else if (operation == "setFrameDataFileEnabled") {
+        setFrameDataFileEnabled(nextBool());
+    } else if (operation == "undo") {
+        undo();
+    } else if (operation == "redo") {
+        redo();
+    } else if (operation == "guessSectionPatternsFromMatches") {
+        int section_start = nextInt();
+        int use_third_n_match = nextInt();
+        int drop_duplicate = nextInt();
+        guessSectionPatternsFromMatches(section_start, use_third_n_match, drop_duplicate);
+    } else if (operation == "guessProjectPatternsFromMatches") {
+        int minimum_length = nextInt();
+        int use_third_n_match = nextInt();
+        int drop_duplicate = nextInt();
+        guessProjectPatternsFromMatches(minimum_length, use_third_n_match, drop_duplicate);
+    } else {
+        throw WobblyException("unknown operation '" + operation + "'.");
+    }
+}
+
+void WobblyProject::readProject(const std::string &path, bool lazy_metrics) {
+    readProjectFile(path, lazy_metrics);
+
+    openJournal(path);
+}
+
+
+void WobblyProject::recoverAutosave(const std::string &path) {
+    // The autosave's journal id and frame data file are its own. The project's journal belongs
+    // to the project file, and is replaced when the recovered project is saved.
+    readProjectFile(path + ".autosave", false);
+
+    // Nothing may keep the autosave's files open, so the next autosave can replace them.
+    unmapFrameData();
+
+    project_path = path;
+}
+
+
+void WobblyProject::readProjectFile(const std::string &path, bool lazy_metrics) {
+    // XXX Make sure the things only written by Wobbly get sane defaults. Actually, make sure everything has sane defaults, since Wibbly doesn't always write all the categories.
+
+    QFile file(QString::fromStdString(path));
+
+    if (!file.open(QIODevice::ReadOnly))
+        throw WobblyException("Couldn't open project file. Error message: " + file.errorString());
+
+    project_path = path;
+
+    // Building the project isn't undoable. Replaying the journal is.
+    UndoPause undo_pause(this);
+
+    // Nothing generated for the previous contents can be used.
+    invalidateScriptFragments();
+
+    // Map the file instead of reading it into memory. It gets unmapped when the QFile is destroyed.
+    QByteArray data_copy;
+    qint64 data_size;
+    const char *data = mapProjectFile(file, data_copy, data_size);
+
+    // Only remember where the metrics are. Script generation doesn't need them.
+    metrics_in_frame_data_file = false;
+    metrics_path = path;
+    mics_offset = -1;
+    decimate_metrics_offset = -1;
+    frame_data_mapping_path.clear();
+
+
+    // The keys can come in any order, so everything that needs validation against
+    // the number of frames is collected first and added at the end.
+
+    fps_num = 0;
+    fps_den = 0;
+    timing_dirty = true;
+    width = 0;
+    height = 0;
+
+    // The per-frame data is built here and replaces the project's at the end.
+    std::shared_ptr<FrameMetrics> json_metrics;
+    if (!lazy_metrics)
+        json_metrics = std::make_shared<FrameMetrics>();
+    std::shared_ptr<OriginalMatches> json_original_matches = std::make_shared<OriginalMatches>();
+
+    PackedMatches json_matches; // Format versions 1 and 2, every frame.
+    std::vector<int> json_combed_frames, json_decimated_frames;
+    std::vector<int> json_combed_ranges, json_decimated_cycles; // Format version 2, expanded to frame numbers.
+    std::vector<Preset> json_presets;
+    std::vector<FreezeFrame> json_frozen_frames;
+    std::vector<Section> json_sections;
+    std::vector<std::vector<std::string> > json_section_presets; // Names, until the presets are added.
+    std::vector<CustomList> json_custom_lists;
+    std::vector<std::string> json_custom_list_presets;
+
+    bool json_resize_found = false;
+    bool json_crop_found = false;
+
+    resize.width = -1;
+    resize.height = -1;
+    crop.left = crop.top = crop.right = crop.bottom = 0;
+
+    int version = 0;
+
+    std::string frame_data_file;
+
+    std::string key, value;
+
+    JsonReader json(data, data_size);
+
+    // The big arrays don't depend on each other, so they are only located in this pass
+    // and decoded in parallel afterwards. Each decoder writes to its own container.
+    // Finding the end of an array only takes matching brackets. The decoder checks the rest.
+    std::vector<std::function<void (JsonReader &)> > decoders;
+    std::vector<size_t> decoder_offsets;
+
+    auto decodeLater = [&] (const std::function<void (JsonReader &)> &decoder) {
+        decoders.push_back(decoder);
+        decoder_offsets.push_back(json.position());
+        if (json.isString())
+            json.skipValue();
+        else
+            json.skipContainer();
+    };
+
+    json.beginObject();
+
+    while (json.nextKey(key)) {
+        if (key == "wibbly wobbly version") {
+            version = (int)json.readInt();
+
+            // Everything written before the format had a real version number says 42.
+            if (version == 42)
+                version = 1;
+
+            if (version > PROJECT_FORMAT_VERSION)
+                throw WobblyException("Project file was created by a newer version of Wobbly (format version " + std::to_string(version) + "). Maximum supported version is " + std::to_string(PROJECT_FORMAT_VERSION) + ".");
+        } else if (key == "input file") {
+            input_file = json.readString();
+        } else if (key == "input frame rate") {
+            int64_t *fps[2] = { &fps_num, &fps_den };
+            json.beginArray();
+            for (int i = 0; json.nextElement(); i++) {
+                if (i < 2)
+                    *fps[i] = json.readInt();
+                else
+                    json.skipValue();
+            }
+        } else if (key == "input resolution") {
+            int *resolution[2] = { &width, &height };
+            json.beginArray();
+            for (int i = 0; json.nextElement(); i++) {
+                if (i < 2)
+                    *resolution[i] = (int)json.readInt();
+                else
+                    json.skipValue();
+            }
+        } else if (key == "trim") {
+            json.beginArray();
+            while (json.nextElement()) {
+                FrameRange range = { 0, 0 };
+                json.beginArray();
+                for (int i = 0; json.nextElement(); i++) {
+                    if (i == 0)
+                        range.first = (int)json.readInt();
+                    else if (i == 1)
+                        range.last = (int)json.readInt();
+                    else
+                        json.skipValue();
+                }
+                trims.insert(std::make_pair(range.first, range));
+            }
+        } else if (key == "vfm parameters" || key == "vdecimate parameters") {
+            std::unordered_map<std::string, double> &parameters = key == "vfm parameters" ? vfm_parameters : vdecimate_parameters;
+            json.beginObject();
+            while (json.nextKey(value))
+                parameters.insert(std::make_pair(value, json.readDouble()));
+        } else if (key == "journal id") {
+            journal_id = json.readString();
+        } else if (key == "frame data file") {
+            frame_data_file = json.readString();
+        } else if (key == "frame data id") {
+            frame_data_id = json.readString();
+        } else if (key == "mics") {
+            if (lazy_metrics) {
+                mics_offset = json.position();
+                json.skipContainer();
+            } else {
+                decodeLater([&json_metrics] (JsonReader &reader) { readMics(reader, json_metrics->mics); });
+            }
+        } else if (key == "matches") {
+            decodeLater([&json_matches] (JsonReader &reader) { readMatches(reader, json_matches); });
+        } else if (key == "match overrides") {
+            decodeLater([this] (JsonReader &reader) { readMatchOverrides(reader, matches); });
+        } else if (key == "original matches") {
+            decodeLater([&json_original_matches] (JsonReader &reader) { readMatches(reader, *json_original_matches); });
+        } else if (key == "combed frames") {
+            decodeLater([&json_combed_frames] (JsonReader &reader) { readFrameList(reader, json_combed_frames); });
+        } else if (key == "decimated frames") {
+            decodeLater([&json_decimated_frames] (JsonReader &reader) { readFrameList(reader, json_decimated_frames); });
+        } else if (key == "combed ranges") {
+            decodeLater([&json_combed_ranges] (JsonReader &reader) { readCombedRanges(reader, json_combed_ranges); });
+        } else if (key == "decimated cycles") {
+            decodeLater([&json_decimated_cycles] (JsonReader &reader) { readDecimatedCycles(reader, json_decimated_cycles); });
+        } else if (key == "decimate metrics") {
+            if (lazy_metrics) {
+                decimate_metrics_offset = json.position();
+                json.skipContainer();
+            } else {
+                decodeLater([&json_metrics] (JsonReader &reader) { readDecimateMetrics(reader, json_metrics->decimate_metrics); });
+            }
+        } else if (key == "presets") {
+            json.beginArray();
+            while (json.nextElement()) {
+                Preset preset;
+                json.beginObject();
+                while (json.nextKey(value)) {
+                    if (value == "name")
+                        preset.name = json.readString();
+                    else if (value == "contents")
+                        preset.contents = json.readString();
+                    else
+                        json.skipValue();
+                }
+                json_presets.push_back(preset);
+            }
+        } else if (key == "frozen frames") {
+            json.beginArray();
+            while (json.nextElement()) {
+                int ff[3] = { 0, 0, 0 };
+                json.beginArray();
+                for (int i = 0; json.nextElement(); i++) {
+                    if (i < 3)
+                        ff[i] = (int)json.readInt();
+                    else
+                        json.skipValue();
+                }
+                json_frozen_frames.push_back({ ff[0], ff[1], ff[2] });
+            }
+        } else if (key == "sections") {
+            json.beginArray();
+            while (json.nextElement()) {
+                Section section(0);
+                std::vector<std::string> section_presets;
+                json.beginObject();
+                while (json.nextKey(value)) {
+                    if (value == "start") {
+                        section.start = (int)json.readInt();
+                    } else if (value == "fps_num") {
+                        section.fps_num = json.readInt();
+                    } else if (value == "fps_den") {
+                        section.fps_den = json.readInt();
+                    } else if (value == "num_frames") {
+                        section.num_frames = (int)json.readInt();
+                    } else if (value == "presets") {
+                        json.beginArray();
+                        while (json.nextElement())
+                            section_presets.push_back(json.readString());
+                    } else {
+                        json.skipValue();
+                    }
+                }
+                json_sections.push_back(section);
+                json_section_presets.push_back(section_presets);
+            }
+        } else if (key == "custom lists") {
+            decodeLater([&json_custom_lists, &json_custom_list_presets] (JsonReader &reader) { readCustomLists(reader, json_custom_lists, json_custom_list_presets); });
+        } else if (key == "resize") {
+            json.beginObject();
+            while (json.nextKey(value)) {
+                json_resize_found = true;
+                if (value == "width")
+                    resize.width = (int)json.readInt();
+                else if (value == "height")
+                    resize.height = (int)json.readInt();
+                else
+                    json.skipValue();
+            }
+        } else if (key == "crop") {
+            int *sides[4] = { &crop.left, &crop.top, &crop.right, &crop.bottom };
+            const char *side_names[4] = { "left", "top", "right", "bottom" };
+            json.beginObject();
+            while (json.nextKey(value)) {
+                json_crop_found = true;
+                int i;
+                for (i = 0; i < 4; i++)
+                    if (value == side_names[i])
+                        break;
+                if (i < 4)
+                    *sides[i] = (int)json.readInt();
+                else
+                    json.skipValue();
+            }
+        } else {
+            json.skipValue();
+        }
+    }
+
+
+    std::vector<QFuture<void> > decoder_futures;
+    std::vector<std::string> decoder_errors(decoders.size());
+
+    for (size_t i = 0; i < decoders.size(); i++) {
+        decoder_futures.push_back(QtConcurrent::run([&, i] () {
+            try {
+                JsonReader reader(data, data_size, decoder_offsets[i]);
+                decoders[i](reader);
+            } catch (WobblyException &e) {
+                decoder_errors[i] = e.what();
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < decoder_futures.size(); i++)
+        decoder_futures[i].waitForFinished();
+
+    for (size_t i = 0; i < decoder_errors.size(); i++)
+        if (!decoder_errors[i].empty())
+            throw WobblyException(decoder_errors[i]);
+
+    json_combed_frames.insert(json_combed_frames.end(), json_combed_ranges.cbegin(), json_combed_ranges.cend());
+    json_decimated_frames.insert(json_decimated_frames.end(), json_decimated_cycles.cbegin(), json_decimated_cycles.cend());
+
+
+
+    num_frames[PostSource] = 0;
+
+    for (auto it = trims.cbegin(); it != trims.cend(); it++)
+        num_frames[PostSource] += it->second.last - it->second.first + 1;
+
+    num_frames[PostFieldMatch] = num_frames[PostSource];
+    num_frames[PostDecimate] = num_frames[PostSource];
+
+
+    frame_data_file_enabled = !frame_data_file.empty();
+
+    if (frame_data_file_enabled) {
+        // The per-frame arrays in the frame data file take precedence over any found in the project.
+        QString frame_data_path = QFileInfo(QString::fromStdString(path)).dir().filePath(QString::fromStdString(frame_data_file));
+
+        json_combed_frames.clear();
+        json_decimated_frames.clear();
+
+        unsigned columns = ~0u;
+
+        if (lazy_metrics) {
+            columns &= ~((1u << FrameDataMics) | (1u << FrameDataDecimateMetrics));
+            metrics_in_frame_data_file = true;
+            metrics_path = frame_data_path.toStdString();
+        }
+
+        json_matches.resize(0, 'c');
+
+        frame_data_mapping_path = frame_data_path.toStdString();
+
+        FrameMetrics unused_metrics;
+        readFrameData(frame_data_path.toStdString(), columns, json_metrics ? *json_metrics : unused_metrics, *json_original_matches, json_matches, json_combed_frames, json_decimated_frames);
+    }
+
+
+    if (json_metrics)
+        json_metrics->resize(num_frames[PostSource]);
+
+    metrics = json_metrics;
+
+
+    json_original_matches->resize(num_frames[PostSource], 'c');
+
+    original_matches = json_original_matches;
+
+    if (json_matches.size()) {
+        // Keep only the frames that differ from the original matches.
+        json_matches.resize(num_frames[PostSource], 'c');
+
+        matches.clear();
+        for (int i = 0; i < num_frames[PostSource]; i++)
+            matches.set(i, json_matches.get(i), original_matches->get(i));
+    } else {
+        matches.erase(INT_MIN, -1);
+        matches.erase(num_frames[PostSource], INT_MAX);
+    }
+
+
+    combed_frames = std::make_shared<FrameBitset>();
+    combed_frames->resize(num_frames[PostSource]);
+    for (size_t i = 0; i < json_combed_frames.size(); i++)
+        addCombedFrame(json_combed_frames[i]);
+
+
+    decimation = std::make_shared<DecimatedCycles>();
+    decimation->frames.resize((num_frames[PostSource] - 1) / 5 + 1, 0);
+    decimation->counts.assign(decimation->frames.size());
+    for (size_t i = 0; i < json_decimated_frames.size(); i++)
+        addDecimatedFrame(json_decimated_frames[i]);
+
+    // num_frames[PostDecimate] is correct at this point.
+
+
+    for (size_t i = 0; i < json_presets.size(); i++)
+        addPreset(json_presets[i].name, json_presets[i].contents);
+
+
+    for (size_t i = 0; i < json_frozen_frames.size(); i++)
+        addFreezeFrame(json_frozen_frames[i].first, json_frozen_frames[i].last, json_frozen_frames[i].replacement);
+
+
+    for (size_t i = 0; i < json_sections.size(); i++) {
+        for (size_t j = 0; j < json_section_presets[i].size(); j++)
+            json_sections[i].presets.push_back(getPresetId(json_section_presets[i][j]));
+
+        addSection(json_sections[i]);
+    }
+
+    if (json_sections.size() == 0) {
+        addSection(0);
+    }
+
+
+    custom_lists.reserve(json_custom_lists.size());
+
+    for (size_t i = 0; i < json_custom_lists.size(); i++) {
+        if (json_custom_list_presets[i].size())
+            json_custom_lists[i].preset = getPresetId(json_custom_list_presets[i]);
+
+        addCustomList(json_custom_lists[i]);
+    }
+
+
+    resize.enabled = json_resize_found;
+    if (resize.width == -1)
+        resize.width = width;
+    if (resize.height == -1)
+        resize.height = height;
+
+    crop.enabled = json_crop_found;
+
+
+    journal_enabled = !journal_id.empty();
+}
+
+
+void WobblyProject::openJournal(const std::string &path) {
+    // Apply the changes saved since the project file was last written.
+    std::string journal_path = path + ".journal";
+    qint64 journal_valid_size, journal_committed_size;
+
+    if (journal_enabled && QFile::exists(QString::fromStdString(journal_path)) &&
+        replayJournal(journal_path, journal_valid_size, journal_committed_size)) {
+        journal = std::make_shared<ProjectJournal>(journal_path);
+        journal->open(journal_valid_size, journal_committed_size);
+
+        // The steps replayed from the journal can be undone and redone from it again.
+        for (size_t i = 0; i < undo_steps.size(); i++)
+            undo_steps[i].in_journal = true;
+        for (size_t i = 0; i < redo_steps.size(); i++)
+            redo_steps[i].in_journal = true;
+    } else if (journal_enabled) {
+        journal = std::make_shared<ProjectJournal>(journal_path);
+        journal->create(journal_id);
+    }
+}
+
+void WobblyProject::addFreezeFrame(int first, int last, int replacement) {
+    if (first > last)
+        std::swap(first, last);
+
+    if (first < 0 || first >= num_frames[PostSource] ||
+        last < 0 || last >= num_frames[PostSource] ||
+        replacement < 0 || replacement >= num_frames[PostSource])
+        throw WobblyException("Can't add FreezeFrame (" + std::to_string(first) + "," + std::to_string(last) + "," + std::to_string(replacement) + "): values out of range.");
+
+    const FreezeFrame *overlap = findOverlappingRange(frozen_frames, first, last);
+
+    if (overlap)
+        throw WobblyException("Can't add FreezeFrame (" + std::to_string(first) + "," + std::to_string(last) + "," + std::to_string(replacement) + "): overlaps (" + std::to_string(overlap->first) + "," + std::to_string(overlap->last) + "," + std::to_string(overlap->replacement) + ").");
+
+    FreezeFrame ff = {
+        .first = first,
+        .last = last,
+        .replacement = replacement
+    };
+    frozen_frames.insert(std::make_pair(first, ff));
+    annotations_dirty = true;
+
+    undoRecord([this, first] () { deleteFreezeFrame(first); });
+
+    notifyChange(ChangeFreezeFrames, first, last);
+
+    journalRecord("addFreezeFrame", first, last, replacement);
+}
+
+void WobblyProject::deleteFreezeFrame(int frame) {
+    auto it = frozen_frames.find(frame);
+
+    if (it != frozen_frames.end()) {
+        FreezeFrame ff = it->second;
+
+        frozen_frames.erase(it);
+        annotations_dirty = true;
+
+        undoRecord([this, ff] () { addFreezeFrame(ff.first, ff.last, ff.replacement); });
+
+        notifyChange(ChangeFreezeFrames, ff.first, ff.last);
+
+        journalRecord("deleteFreezeFrame", frame);
+    }
+}
+
+const FreezeFrame *WobblyProject::findFreezeFrame(int frame) {
+    return findOverlappingRange(frozen_frames, frame, frame);
+}
+
+
+void WobblyProject::addPreset(const std::string &preset_name) {
+    std::string contents =
+            "# The preset is a Python function. It takes a single parameter, called 'clip'.\n"
+            "# Filter that and assign the result to the same variable.\n"
+            "# The VapourSynth core object is called 'c'.\n";
+    addPreset(preset_name, contents);
+}
+
+
+bool WobblyProject::isNameSafeForPython(const std::string &name) {
+    for (size_t i = 0; i < name.size(); i++) {
+        const char &c = name[i];
+
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (i && c >= '0' && c <= '9') || c == '_'))
+            return false;
+    }
+
+    return true;
+}
+
+void WobblyProject::addPreset(const std::string &preset_name, const std::string &preset_contents) {
+    if (!isNameSafeForPython(preset_name))
+        throw WobblyException("Can't add preset '" + preset_name + "': name is invalid. Use only letters, numbers, and the underscore character. The first character cannot be a number.");
+
+    Preset preset;
+    preset.id = (int)preset_names.size();
+    preset.name = preset_name;
+    preset.contents = preset_contents;
+
+    if (presets.insert(std::make_pair(preset_name, preset)).second) {
+        preset_names.push_back(preset_name);
+        preset_references.push_back(PresetReferences());
+
+        undoRecord([this, preset_name] () { deletePreset(preset_name); });
+
+        notifyChange(ChangePresets, 0, -1);
+    }
+
+    journalRecord("addPreset", preset_name, preset_contents);
+}
+
+void WobblyProject::renamePreset(const std::string &old_name, const std::string &new_name) {
+    auto it = presets.find(old_name);
+
+    if (it == presets.end())
+        throw WobblyException("Can't rename preset '" + old_name + "' to '" + new_name + "': no such preset.");
+
+    if (!isNameSafeForPython(new_name))
+        throw WobblyException("Can't rename preset '" + old_name + "' to '" + new_name + "': new name is invalid. Use only letters, numbers, and the underscore character. The first character cannot be a number.");
+
+    if (new_name == old_name)
+        return;
+
+    if (presets.count(new_name))
+        throw WobblyException("Can't rename preset '" + old_name + "' to '" + new_name + "': a preset with this name already exists.");
+
+    // Sections and custom lists use the id, so they don't change.
+    Preset preset = it->second;
+    preset.name = new_name;
+
+    undoRecord([this, old_name, new_name] () { renamePreset(new_name, old_name); });
+
+    presets.erase(it);
+    presets.insert(std::make_pair(new_name, preset));
+    preset_names[preset.id] = new_name;
+
+    notifyPresetChange(preset_references[preset.id]);
+
+    journalRecord("renamePreset", old_name, new_name);
+}
+
+void WobblyProject::deletePreset(const std::string &preset_name) {
+    auto preset = presets.find(preset_name);
+
+    if (preset == presets.end())
+        throw WobblyException("Can't delete preset '" + preset_name + "': no such preset.");
+
+    int id = preset->second.id;
+    std::string contents = preset->second.contents;
+
+    PresetReferences references;
+    std::swap(references, preset_references[id]);
+
+    // Where the preset was used: (section start, index) and list indices.
+    std::vector<std::pair<int, size_t> > section_uses;
+    std::vector<int> list_uses(references.custom_lists.cbegin(), references.custom_lists.cend());
+
+    for (auto it = references.sections.cbegin(); it != references.sections.cend(); it++) {
+        std::vector<int> &section_presets = sections.at(it->first).presets;
+
+        for (size_t j = 0; j < section_presets.size(); j++)
+            if (section_presets[j] == id)
+                section_uses.push_back(std::make_pair(it->first, j));
+
+        section_presets.erase(std::remove(section_presets.begin(), section_presets.end(), id), section_presets.end());
+    }
+
+    for (size_t i = 0; i < list_uses.size(); i++)
+        custom_lists[list_uses[i]].preset = -1;
+
+    undoRecord([this, id, preset_name, contents, section_uses, list_uses] () {
+        // The preset comes back with the same id, which older undo steps may still use.
+        Preset restored;
+        restored.id = id;
+        restored.name = preset_name;
+        restored.contents = contents;
+        presets.insert(std::make_pair(preset_name, restored));
+        preset_names[id] = preset_name;
+
+        for (size_t i = 0; i < section_uses.size(); i++) {
+            std::vector<int> &section_presets = sections.at(section_uses[i].first).presets;
+            section_presets.insert(section_presets.begin() + section_uses[i].second, id);
+            preset_references[id].sections[section_uses[i].first]++;
+        }
+
+        for (size_t i = 0; i < list_uses.size(); i++) {
+            custom_lists[list_uses[i]].preset = id;
+            preset_references[id].custom_lists.insert(list_uses[i]);
+        }
+
+        undoRecord([this, preset_name] () { deletePreset(preset_name); });
+
+        notifyPresetChange(preset_references[id]);
+    });
+
+    presets.erase(preset);
+    preset_names[id].clear();
+
+    notifyPresetChange(references);
+
+    journalRecord("deletePreset", preset_name);
+}
+
+const std::string &WobblyProject::getPresetContents(const std::string &preset_name) {
+    if (!presets.count(preset_name))
+        throw WobblyException("Can't retrieve the contents of preset '" + preset_name + "': no such preset.");
+
+    const Preset &preset = presets.at(preset_name);
+    return preset.contents;
+}
+
+void WobblyProject::setPresetContents(const std::string &preset_name, const std::string &preset_contents) {
+    if (!presets.count(preset_name))
+        throw WobblyException("Can't modify the contents of preset '" + preset_name + "': no such preset.");
+
+    Preset &preset = presets.at(preset_name);
+
+    // This gets called every time the preset editor loses focus.
+    if (preset.contents == preset_contents)
+        return;
+
+    std::string old_contents = preset.contents;
+    preset.contents = preset_contents;
+
+    undoRecord([this, preset_name, old_contents] () { setPresetContents(preset_name, old_contents); });
+
+    notifyPresetChange(preset_references[preset.id]);
+
+    journalRecord("setPresetContents", preset_name, preset_contents);
+}
+
+void WobblyProject::assignPresetToSection(const std::string &preset_name, int section_start) {
+    auto preset = presets.find(preset_name);
+
+    if (preset == presets.end())
+        throw WobblyException("Can't assign preset '" + preset_name + "' to section starting at " + std::to_string(section_start) + ": no such preset.");
+
+    int id = preset->second.id;
+
+    // The user may want to assign the same preset twice.
+    sections.at(section_start).presets.push_back(id);
+    preset_references[id].sections[section_start]++;
+
+    undoRecord([this, preset_name, section_start, id] () {
+        sections.at(section_start).presets.pop_back();
+
+        auto uses = preset_references[id].sections.find(section_start);
+        if (--uses->second == 0)
+            preset_references[id].sections.erase(uses);
+
+        undoRecord([this, preset_name, section_start] () { assignPresetToSection(preset_name, section_start); });
+
+        notifyChange(ChangeSections, section_start, getSectionEnd(section_start) - 1);
+    });
+
+    notifyChange(ChangeSections, section_start, getSectionEnd(section_start) - 1);
+
+    journalRecord("assignPresetToSection", preset_name, section_start);
+}
+
+int WobblyProject::getPresetId(const std::string &preset_name) {
+    auto preset = presets.find(preset_name);
+
+    if (preset == presets.end())
+        throw WobblyException("Can't find the id of preset '" + preset_name + "': no such preset.");
+
+    return preset->second.id;
+}
+
+const std::string &WobblyProject::getPresetName(int preset_id) {
+    if (preset_id < 0 || preset_id >= (int)preset_names.size() || preset_names[preset_id].empty())
+        throw WobblyException("Can't find the name of preset " + std::to_string(preset_id) + ": no such preset.");
+
+    return preset_names[preset_id];
+}
+
+
+void WobblyProject::setMatch(int frame, char match) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't set the match for frame " + std::to_string(frame) + ": value out of range.");
+
+    undoRecordMatches(frame, frame);
+
+    matches.set(frame, match, original_matches->get(frame));
+
+    notifyChange(ChangeMatches, frame, frame);
+
+    journalRecord("setMatch", frame, match);
+}
+
+
+char WobblyProject::getMatch(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't get the match for frame " + std::to_string(frame) + ": value out of range.");
+
+    const MatchRun *run = matches.find(frame);
+    if (run)
+        return run->get(frame);
+
+    return original_matches->get(frame);
+}
+
+
+char WobblyProject::getOriginalMatch(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't get the original match for frame " + std::to_string(frame) + ": value out of range.");
+
+    return original_matches->get(frame);
+}
+
+
+int16_t WobblyProject::getMic(int frame, int match_index) {
+    if (frame < 0 || frame >= num_frames[PostSource] || match_index < 0 || match_index > 4)
+        throw WobblyException("Can't get the mic for frame " + std::to_string(frame) + ": value out of range.");
+
+    if (!metrics)
+        loadMetrics();
+
+    return metrics->getMic(frame, match_index);
+}
+
+
+int WobblyProject::getDecimateMetric(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't get the decimate metric for frame " + std::to_string(frame) + ": value out of range.");
+
+    if (!metrics)
+        loadMetrics();
+
+    return metrics->getDecimateMetric(frame);
+}
+
+
+void WobblyProject::addSection(int section_start) {
+    Section section(section_start);
+    addSection(section);
+}
+
+void WobblyProject::addSection(const Section &section) {
+    if (section.start < 0 || section.start >= num_frames[PostSource])
+        throw WobblyException("Can't add section starting at " + std::to_string(section.start) + ": value out of range.");
+
+    for (size_t i = 0; i < section.presets.size(); i++)
+        if (section.presets[i] < 0 || section.presets[i] >= (int)preset_names.size() || preset_names[section.presets[i]].empty())
+            throw WobblyException("Can't add section starting at " + std::to_string(section.start) + ": preset " + std::to_string(section.presets[i]) + " doesn't exist.");
+
+    if (sections.insert(std::make_pair(section.start, section)).second) {
+        addSectionReferences(section);
+
+        int section_start = section.start;
+        undoRecord([this, section_start] () { deleteSection(section_start); });
+
+        notifyChange(ChangeSections, section_start, getSectionEnd(section_start) - 1);
+    }
+    annotations_dirty = true;
+    timing_dirty = true;
+
+    // The journal uses names, like the project file.
+    std::vector<std::string> section_preset_names;
+    for (size_t i = 0; i < section.presets.size(); i++)
+        section_preset_names.push_back(preset_names[section.presets[i]]);
+
+    journalRecord("addSection", section.start, section_preset_names, section.fps_num, section.fps_den, section.num_frames);
+}
+
+void WobblyProject::deleteSection(int section_start) {
+    auto it = sections.find(section_start);
+
+    // Never delete the very first section.
+    if (section_start > 0 && it != sections.end()) {
+        Section section = it->second;
+
+        deleteSectionReferences(section);
+        sections.erase(it);
+        annotations_dirty = true;
+        timing_dirty = true;
+
+        undoRecord([this, section] () { addSection(section); });
+
+        notifyChange(ChangeSections, section_start, getSectionEnd(section_start) - 1);
+
+        journalRecord("deleteSection", section_start);
+    }
+}
+
+const Section *WobblyProject::findSection(int frame) {
+    auto it = sections.upper_bound(frame);
+    it--;
+    return &it->second;
+}
+
+const Section *WobblyProject::findNextSection(int frame) {
+    auto it = sections.upper_bound(frame);
+
+    if (it != sections.cend())
+        return &it->second;
+
+    return nullptr;
+}
+
+int WobblyProject::getSectionEnd(int frame) {
+    const Section *next_section = findNextSection(frame);
+    if (next_section)
+        return next_section->start;
+    else
+        return num_frames[PostSource];
+}
+
+void WobblyProject::setSectionMatchesFromPattern(int section_start, const std::string &pattern) {
+    int section_end = getSectionEnd(section_start);
+
+    atomicChange([&] () {
+        // Yatta does it like this.
+        setRangeMatchesFromPattern(section_start, section_end - 1, pattern);
+    });
+
+    journalRecord("setSectionMatchesFromPattern", section_start, pattern);
+}
+
+void WobblyProject::setSectionDecimationFromPattern(int section_start, const std::string &pattern) {
+    int section_end = getSectionEnd(section_start);
+
+    atomicChange([&] () {
+        // Yatta does it like this.
+        setRangeDecimationFromPattern(section_start, section_end - 1, pattern);
+    });
+
+    journalRecord("setSectionDecimationFromPattern", section_start, pattern);
+}
+
+void WobblyProject::setRangeMatchesFromPattern(int start, int end, const std::string &pattern) {
+    if (start > end)
+        std::swap(start, end);
+
+    if (start < 0 || end >= num_frames[PostSource])
+        throw WobblyException("Can't set the matches for range [" + std::to_string(start) + "," + std::to_string(end) + "]: values out of range.");
+
+    // Checked before anything is recorded, so a bad pattern leaves nothing behind for the next undo step.
+    if (pattern.empty() || pattern.size() > 5)
+        throw WobblyException("Can't use match pattern '" + pattern + "': must be between 1 and 5 characters long.");
+
+    for (size_t i = 0; i < pattern.size(); i++)
+        if (matchCharToIndex(pattern[i]) == 255)
+            throw WobblyException("Can't use match pattern '" + pattern + "': must contain only p, c, n, b, u.");
+
+    int last_frame = num_frames[PostSource] - 1;
+    char first_match = getMatch(0);
+    char last_match = getMatch(last_frame);
+
+    undoRecordMatches(start, end);
+
+    // The whole range becomes one run.
+    matches.setPattern(start, end, start, pattern);
+
+    // Skip the first and last frame if their new matches are incompatible.
+    char new_match = getMatch(0);
+    if (start == 0 && (new_match == 'p' || new_match == 'b'))
+        matches.set(0, first_match, original_matches->get(0));
+
+    new_match = getMatch(last_frame);
+    if (end == last_frame && (new_match == 'n' || new_match == 'u'))
+        matches.set(last_frame, last_match, original_matches->get(last_frame));
+
+    notifyChange(ChangeMatches, start, end);
+
+    journalRecord("setRangeMatchesFromPattern", start, end, pattern);
+}
+
+void WobblyProject::setRangeDecimationFromPattern(int start, int end, const std::string &pattern) {
+    if (start > end)
+        std::swap(start, end);
+
+    if (start < 0 || end >= num_frames[PostSource])
+        throw WobblyException("Can't set the decimation for range [" + std::to_string(start) + "," + std::to_string(end) + "]: values out of range.");
+
+    if (pattern.size() != 5)
+        throw WobblyException("Can't use decimation pattern '" + pattern + "': must be 5 characters long.");
+
+    // The pattern starts at start, so every cycle gets the same bits.
+    uint8_t pattern_mask = 0;
+    for (int i = 0; i < 5; i++)
+        if (pattern[((i - start) % 5 + 5) % 5] == 'd')
+            pattern_mask |= 1 << i;
+
+    undoRecordDecimation(start, end);
+
+    for (int i = start / 5; i <= end / 5; i++)
+        setCycleDecimation(i, cycleRangeMask(i, start, end), pattern_mask);
+
+    notifyChange(ChangeDecimation, start, end);
+
+    journalRecord("setRangeDecimationFromPattern", start, end, pattern);
+}
+
+
+void WobblyProject::resetRangeMatches(int start, int end) {
+    if (start > end)
+        std::swap(start, end);
+
+    if (start < 0 || end >= num_frames[PostSource])
+        throw WobblyException("Can't reset the matches for range [" + std::to_string(start) + "," + std::to_string(end) + "]: values out of range.");
+
+    undoRecordMatches(start, end);
+
+    matches.erase(start, end);
+
+    notifyChange(ChangeMatches, start, end);
+
+    journalRecord("resetRangeMatches", start, end);
+}
+
+
+void WobblyProject::resetSectionMatches(int section_start) {
+    int section_end = getSectionEnd(section_start);
+
+    resetRangeMatches(section_start, section_end - 1);
+}
+
+
+void WobblyProject::updateAnnotations() {
+    annotations.clear();
+
+    // Trims are in source frames, everything else after trimming. Store where each trim ends up.
+    int trim_start = 0;
+    for (auto it = trims.cbegin(); it != trims.cend(); it++) {
+        int length = it->second.last - it->second.first + 1;
+
+        annotations.beginLayer(AnnotationTrim, it->first);
+        annotations.add(trim_start, trim_start + length - 1);
+
+        trim_start += length;
+    }
+
+    annotations.beginLayer(AnnotationSection, 0);
+    for (auto it = sections.cbegin(); it != sections.cend(); it++) {
+        auto next = std::next(it);
+        annotations.add(it->first, (next != sections.cend() ? next->first : num_frames[PostSource]) - 1);
+    }
+
+    annotations.beginLayer(AnnotationFreezeFrame, 0);
+    for (auto it = frozen_frames.cbegin(); it != frozen_frames.cend(); it++)
+        annotations.add(it->second.first, it->second.last);
+
+    for (size_t i = 0; i < custom_lists.size(); i++) {
+        annotations.beginLayer(AnnotationCustomList, (int)i);
+        for (auto it = custom_lists[i].frames.cbegin(); it != custom_lists[i].frames.cend(); it++)
+            annotations.add(it->second.first, it->second.last);
+    }
+
+    annotations_dirty = false;
+}
+
+
+void WobblyProject::findAnnotations(int first, int last, std::vector<Interval> &result) {
+    if (annotations_dirty)
+        updateAnnotations();
+
+    if (first > last)
+        std::swap(first, last);
+
+    annotations.findOverlapping(first, last, result);
+}
+
+
+void WobblyProject::addCustomList(const std::string &list_name) {
+    CustomList list(list_name);
+    addCustomList(list);
+}
+
+void WobblyProject::addCustomList(const CustomList &list) {
+    if (list.position < 0 || list.position >= 3)
+        throw WobblyException("Can't add custom list '" + list.name + "' with position " + std::to_string(list.position) + ": position out of range.");
+
+    if (!isNameSafeForPython(list.name))
+        throw WobblyException("Can't add custom list '" + list.name + "': name is invalid. Use only letters, numbers, and the underscore character. The first character cannot be a number.");
+
+    if (list.preset != -1 && (list.preset < 0 || list.preset >= (int)preset_names.size() || preset_names[list.preset].empty()))
+        throw WobblyException("Can't add custom list '" + list.name + "' with preset " + std::to_string(list.preset) + ": no such preset.");
+
+    for (size_t i = 0; i < custom_lists.size(); i++)
+        if (custom_lists[i].name == list.name)
+            throw WobblyException("Can't add custom list '" + list.name + "': a list with this name already exists.");
+
+    custom_lists.push_back(list);
+    annotations_dirty = true;
+
+    int list_index = (int)custom_lists.size() - 1;
+    moveCustomListReference(list_index, -1);
+
+    undoRecord([this, list_index] () { deleteCustomList(list_index); });
+
+    notifyCustomListChange(list);
+
+    journalRecord("addCustomList", list.name, list.preset != -1 ? preset_names[list.preset] : std::string(), list.position, list.frames);
+}
+
+void WobblyProject::deleteCustomList(const std::string &list_name) {
+    for (size_t i = 0; i < custom_lists.size(); i++)
+        if (custom_lists[i].name == list_name) {
+            deleteCustomList(i);
+            return;
+        }
+
+    throw WobblyException("Can't delete custom list with name '" + list_name + "': no such list.");
+}
+
+void WobblyProject::deleteCustomList(int list_index) {
+    if (list_index < 0 || list_index >= (int)custom_lists.size())
+        throw WobblyException("Can't delete custom list with index " + std::to_string(list_index) + ": index out of range.");
+
+    CustomList list = custom_lists[list_index];
+
+    moveCustomListReference(-1, list_index);
+    custom_lists.erase(custom_lists.cbegin() + list_index);
+    for (size_t i = list_index; i < custom_lists.size(); i++)
+        moveCustomListReference((int)i, (int)i + 1);
+
+    annotations_dirty = true;
+
+    undoRecord([this, list, list_index] () {
+        // Put it back where it was.
+        custom_lists.insert(custom_lists.begin() + list_index, list);
+        for (size_t i = custom_lists.size() - 1; i > (size_t)list_index; i--)
+            moveCustomListReference((int)i, (int)i - 1);
+        moveCustomListReference(list_index, -1);
+
+        annotations_dirty = true;
+
+        undoRecord([this, list_index] () { deleteCustomList(list_index); });
+
+        notifyCustomListChange(list);
+    });
+
+    notifyCustomListChange(list);
+
+    journalRecord("deleteCustomList", list_index);
+}
+
+
+void WobblyProject::addSectionReferences(const Section &section) {
+    for (size_t i = 0; i < section.presets.size(); i++)
+        preset_references[section.presets[i]].sections[section.start]++;
+}
+
+
+void WobblyProject::deleteSectionReferences(const Section &section) {
+    for (size_t i = 0; i < section.presets.size(); i++) {
+        std::map<int, int> &uses = preset_references[section.presets[i]].sections;
+
+        auto it = uses.find(section.start);
+        if (--it->second == 0)
+            uses.erase(it);
+    }
+}
+
+
+// The custom list at old_index is now at list_index. When a list is added, old_index is -1.
+// When one is removed, list_index is -1 and the list must still be at old_index.
+void WobblyProject::moveCustomListReference(int list_index, int old_index) {
+    int preset = custom_lists[list_index != -1 ? list_index : old_index].preset;
+
+    if (preset == -1)
+        return;
+
+    if (old_index != -1)
+        preset_references[preset].custom_lists.erase(old_index);
+    if (list_index != -1)
+        preset_references[preset].custom_lists.insert(list_index);
+}
+
+
+void WobblyProject::addDecimatedFrame(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't mark frame " + std::to_string(frame) + " for decimation: value out of range.");
+
+    uint8_t bit = 1 << (frame % 5);
+
+    if (!(decimation->frames[frame / 5] & bit)) {
+        DecimatedCycles &cycles = detach(decimation);
+        cycles.frames[frame / 5] |= bit;
+        cycles.counts.add(frame / 5, 1);
+        num_frames[PostDecimate]--;
+
+        undoRecord([this, frame] () { deleteDecimatedFrame(frame); });
+
+        notifyChange(ChangeDecimation, frame, frame);
+
+        journalRecord("addDecimatedFrame", frame);
+    }
+}
+
+
+void WobblyProject::deleteDecimatedFrame(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't delete decimated frame " + std::to_string(frame) + ": value out of range.");
+
+    uint8_t bit = 1 << (frame % 5);
+
+    if (decimation->frames[frame / 5] & bit) {
+        DecimatedCycles &cycles = detach(decimation);
+        cycles.frames[frame / 5] &= ~bit;
+        cycles.counts.add(frame / 5, -1);
+        num_frames[PostDecimate]++;
+
+        undoRecord([this, frame] () { addDecimatedFrame(frame); });
+
+        notifyChange(ChangeDecimation, frame, frame);
+
+        journalRecord("deleteDecimatedFrame", frame);
+    }
+}
+
+
+bool WobblyProject::isDecimatedFrame(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't check if frame " + std::to_string(frame) + " is decimated: value out of range.");
+
+    return (decimation->frames[frame / 5] >> (frame % 5)) & 1;
+}
+
+
+void WobblyProject::clearDecimatedFramesFromCycle(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't clear decimated frames from cycle containing frame " + std::to_string(frame) + ": value out of range.");
+
+    int cycle = frame / 5;
+
+    int new_frames = countBits(decimation->frames[cycle]);
+
+    if (new_frames) {
+        uint8_t mask = decimation->frames[cycle];
+
+        undoRecord([this, cycle, mask] () {
+            for (int i = 0; i < 5; i++)
+                if (mask & (1 << i))
+                    addDecimatedFrame(cycle * 5 + i);
+        });
+
+        DecimatedCycles &cycles = detach(decimation);
+        cycles.frames[cycle] = 0;
+        cycles.counts.add(cycle, -new_frames);
+
+        num_frames[PostDecimate] += new_frames;
+
+        notifyChange(ChangeDecimation, cycle * 5, std::min(cycle * 5 + 4, num_frames[PostSource] - 1));
+
+        journalRecord("clearDecimatedFramesFromCycle", frame);
+    }
+}
+
+
+void WobblyProject::clearDecimatedFramesFromRange(int start, int end) {
+    if (start > end)
+        std::swap(start, end);
+
+    if (start < 0 || end >= num_frames[PostSource])
+        throw WobblyException("Can't clear decimated frames from range [" + std::to_string(start) + "," + std::to_string(end) + "]: values out of range.");
+
+    undoRecordDecimation(start, end);
+
+    for (int i = start / 5; i <= end / 5; i++)
+        setCycleDecimation(i, cycleRangeMask(i, start, end), 0);
+
+    notifyChange(ChangeDecimation, start, end);
+
+    journalRecord("clearDecimatedFramesFromRange", start, end);
+}
+
+
+void WobblyProject::setCycleDecimation(int cycle, uint8_t mask, uint8_t value) {
+    uint8_t bits = decimation->frames[cycle];
+    uint8_t changed = (bits ^ value) & mask;
+
+    if (!changed)
+        return;
+
+    int difference = countBits(value & changed) - countBits(bits & changed);
+
+    DecimatedCycles &cycles = detach(decimation);
+    cycles.frames[cycle] ^= changed;
+    cycles.counts.add(cycle, difference);
+    num_frames[PostDecimate] -= difference;
+}
+
+
+void WobblyProject::addCombedFrame(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        throw WobblyException("Can't mark frame " + std::to_string(frame) + " as combed: value out of range.");
+
+    if (!combed_frames->test(frame)) {
+        detach(combed_frames).set(frame);
+
+        undoRecord([this, frame] () { deleteCombedFrame(frame); });
+
+        notifyChange(ChangeCombedFrames, frame, frame);
+
+        journalRecord("addCombedFrame", frame);
+    }
+}
+
+
+void WobblyProject::deleteCombedFrame(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        return;
+
+    if (combed_frames->test(frame)) {
+        detach(combed_frames).reset(frame);
+
+        undoRecord([this, frame] () { addCombedFrame(frame); });
+
+        notifyChange(ChangeCombedFrames, frame, frame);
+
+        journalRecord("deleteCombedFrame", frame);
+    }
+}
+
+
+void WobblyProject::addCombedRange(int start, int end) {
+    if (start > end)
+        std::swap(start, end);
+
+    if (start < 0 || end >= num_frames[PostSource])
+        throw WobblyException("Can't mark frames [" + std::to_string(start) + "," + std::to_string(end) + "] as combed: values out of range.");
+
+    if (getNumCombedFrames(start, end) == end - start + 1)
+        return;
+
+    undoRecordCombedFrames(start, end);
+
+    detach(combed_frames).setRange(start, end, true);
+
+    notifyChange(ChangeCombedFrames, start, end);
+
+    journalRecord("addCombedRange", start, end);
+}
+
+
+void WobblyProject::deleteCombedRange(int start, int end) {
+    if (start > end)
+        std::swap(start, end);
+
+    if (start < 0 || end >= num_frames[PostSource])
+        throw WobblyException("Can't delete combed frames [" + std::to_string(start) + "," + std::to_string(end) + "]: values out of range.");
+
+    if (getNumCombedFrames(start, end) == 0)
+        return;
+
+    undoRecordCombedFrames(start, end);
+
+    detach(combed_frames).setRange(start, end, false);
+
+    notifyChange(ChangeCombedFrames, start, end);
+
+    journalRecord("deleteCombedRange", start, end);
+}
+
+
+bool WobblyProject::isCombedFrame(int frame) {
+    if (frame < 0 || frame >= num_frames[PostSource])
+        return false;
+
+    return combed_frames->test(frame);
+}
+
+
+int WobblyProject::findNextCombedFrame(int frame) {
+    return combed_frames->findNext(frame + 1);
+}
+
+
+int WobblyProject::findPreviousCombedFrame(int frame) {
+    return combed_frames->findPrevious(frame - 1);
+}
+
+
+int WobblyProject::getNumCombedFrames(int first, int last) {
+    if (first > last)
+        std::swap(first, last);
+
+    return combed_frames->rank(last + 1) - combed_frames->rank(first);
+}
+
+
+void WobblyProject::setResize(int new_width, int new_height) {
+    if (new_width <= 0 || new_height <= 0)
+        throw WobblyException("Can't resize to " + std::to_string(new_width) + "x" + std::to_string(new_height) + ": dimensions must be positive.");
+
+    Resize old_resize = resize;
+    undoRecord([this, old_resize] () { setResize(old_resize.width, old_resize.height); });
+
+    resize.width = new_width;
+    resize.height = new_height;
+
+    notifyChange(ChangeCropResize, 0, num_frames[PostSource] - 1);
+
+    journalRecord("setResize", new_width, new_height);
+}
+
+
+void WobblyProject::setResizeEnabled(bool enabled) {
+    bool old_enabled = resize.enabled;
+    undoRecord([this, old_enabled] () { setResizeEnabled(old_enabled); });
+
+    resize.enabled = enabled;
+
+    notifyChange(ChangeCropResize, 0, num_frames[PostSource] - 1);
+
+    journalRecord("setResizeEnabled", enabled);
+}
+
+
+bool WobblyProject::isResizeEnabled() {
+    return resize.enabled;
+}
+
+
+void WobblyProject::setCrop(int left, int top, int right, int bottom) {
+    if (left < 0 || top < 0 || right < 0 || bottom < 0)
+        throw WobblyException("Can't crop (" + std::to_string(left) + "," + std::to_string(top) + "," + std::to_string(right) + "," + std::to_string(bottom) + "): negative values.");
+
+    Crop old_crop = crop;
+    undoRecord([this, old_crop] () { setCrop(old_crop.left, old_crop.top, old_crop.right, old_crop.bottom); });
+
+    crop.left = left;
+    crop.top = top;
+    crop.right = right;
+    crop.bottom = bottom;
+
+    notifyChange(ChangeCropResize, 0, num_frames[PostSource] - 1);
+
+    journalRecord("setCrop", left, top, right, bottom);
+}
+
+
+void WobblyProject::setCropEnabled(bool enabled) {
+    bool old_enabled = crop.enabled;
+    undoRecord([this, old_enabled] () { setCropEnabled(old_enabled); });
+
+    crop.enabled = enabled;
 
-    custom_lists.push_back(list);
+    notifyChange(ChangeCropResize, 0, num_frames[PostSource] - 1);
+
+    journalRecord("setCropEnabled", enabled);
 }
 
-void WobblyProject::deleteCustomList(const std::string &list_name) {
-    for (size_t i = 0; i < custom_lists.size(); i++)
-        if (custom_lists[i].name == list_name) {
-            deleteCustomList(i);
-            return;
-        }
 
-    throw WobblyException("Can't delete custom list with name '" + list_name + "': no such list.");
+bool WobblyProject::isCropEnabled() {
+    return crop.enabled;
 }
 
-void WobblyProject::deleteCustomList(int list_index) {
-    if (list_index < 0 || list_index >= (int)custom_lists.size())
-        throw WobblyException("Can't delete custom list with index " + std::to_string(list_index) + ": index out of range.");
 
-    custom_lists.erase(custom_lists.cbegin() + list_index);
-}
+void WobblyProject::setFrameDataFileEnabled(bool enabled) {
+    bool old_enabled = frame_data_file_enabled;
+    undoRecord([this, old_enabled] () { setFrameDataFileEnabled(old_enabled); });
 
+    frame_data_file_enabled = enabled;
 
-void WobblyProject::addDecimatedFrame(int frame) {
-    if (frame < 0 || frame >= num_frames[PostSource])
-        throw WobblyException("Can't mark frame " + std::to_string(frame) + " for decimation: value out of range.");
+    journalRecord("setFrameDataFileEnabled", enabled);
+}
 
-    auto result = decimated_frames[frame / 5].insert(frame % 5);
 
-    if (result.second)
-        num_frames[PostDecimate]--;
+bool WobblyProject::isFrameDataFileEnabled() {
+    return frame_data_file_enabled;
 }
 
 
-void WobblyProject::deleteDecimatedFrame(int frame) {
-    if (frame < 0 || frame >= num_frames[PostSource])
-        throw WobblyException("Can't delete decimated frame " + std::to_string(frame) + ": value out of range.");
+void WobblyProject::updateTiming() {
+    timing_starts.clear();
+    timing_times.clear();
+    timing_durations.clear();
 
-    size_t result = decimated_frames[frame / 5].erase(frame % 5);
+    double project_duration = fps_num > 0 ? (double)fps_den / fps_num : 0.0;
 
-    if (result)
-        num_frames[PostDecimate]++;
-}
+    if (sections.empty() || sections.cbegin()->first > 0) {
+        timing_starts.push_back(0);
+        timing_times.push_back(0.0);
+        timing_durations.push_back(project_duration);
+    }
 
+    for (auto it = sections.cbegin(); it != sections.cend(); it++) {
+        double time = 0.0;
+        if (!timing_starts.empty())
+            time = timing_times.back() + (it->first - timing_starts.back()) * timing_durations.back();
 
-bool WobblyProject::isDecimatedFrame(int frame) {
-    if (frame < 0 || frame >= num_frames[PostSource])
-        throw WobblyException("Can't check if frame " + std::to_string(frame) + " is decimated: value out of range.");
+        const Section &section = it->second;
 
-    return (bool)decimated_frames[frame / 5].count(frame % 5);
+        timing_starts.push_back(section.start);
+        timing_times.push_back(time);
+        timing_durations.push_back(section.fps_num > 0 && section.fps_den > 0 ? (double)section.fps_den / section.fps_num : project_duration);
+    }
+
+    timing_dirty = false;
 }
 
 
-void WobblyProject::clearDecimatedFramesFromCycle(int frame) {
-    if (frame < 0 || frame >= num_frames[PostSource])
-        throw WobblyException("Can't clear decimated frames from cycle containing frame " + std::to_string(frame) + ": value out of range.");
+size_t WobblyProject::findTimingSegment(int frame) {
+    if (timing_dirty)
+        updateTiming();
 
-    int cycle = frame / 5;
+    size_t segment = std::upper_bound(timing_starts.cbegin(), timing_starts.cend(), frame) - timing_starts.cbegin();
+    if (segment > 0)
+        segment--;
+
+    return segment;
+}
 
-    size_t new_frames = decimated_frames[cycle].size();
 
-    decimated_frames[cycle].clear();
+double WobblyProject::sourceFrameTime(int frame) {
+    size_t segment = findTimingSegment(frame);
 
-    num_frames[PostDecimate] += new_frames;
+    return timing_times[segment] + (frame - timing_starts[segment]) * timing_durations[segment];
 }
 
 
-void WobblyProject::addCombedFrame(int frame) {
-    if (frame < 0 || frame >= num_frames[PostSource])
-        throw WobblyException("Can't mark frame " + std::to_string(frame) + " as combed: value out of range.");
+void WobblyProject::getCycleTiming(int cycle, double &start_time, double &end_time, int &surviving) {
+    int cycle_start = cycle * 5;
+    int cycle_end = std::min(cycle_start + 5, num_frames[PostSource]);
 
-    combed_frames.insert(frame);
-}
+    // Unless a section starts in the middle of the cycle, the whole cycle runs at one source frame rate.
+    size_t segment = findTimingSegment(cycle_start);
 
+    start_time = timing_times[segment] + (cycle_start - timing_starts[segment]) * timing_durations[segment];
 
-void WobblyProject::deleteCombedFrame(int frame) {
-    combed_frames.erase(frame);
+    if (segment + 1 == timing_starts.size() || timing_starts[segment + 1] >= cycle_end)
+        end_time = timing_times[segment] + (cycle_end - timing_starts[segment]) * timing_durations[segment];
+    else
+        end_time = sourceFrameTime(cycle_end);
+
+    surviving = 0;
+    for (int i = 0; i < cycle_end - cycle_start; i++)
+        if (!(decimation->frames[cycle] & (1 << i)))
+            surviving++;
 }
 
 
-bool WobblyProject::isCombedFrame(int frame) {
-    return (bool)combed_frames.count(frame);
-}
+double WobblyProject::frameToSeconds(int frame) {
+    if (frame < 0)
+        frame = 0;
 
+    if (frame < num_frames[PostSource] && isDecimatedFrame(frame))
+        frame = findNextSurvivingFrame(frame);
 
-void WobblyProject::setResize(int new_width, int new_height) {
-    if (new_width <= 0 || new_height <= 0)
-        throw WobblyException("Can't resize to " + std::to_string(new_width) + "x" + std::to_string(new_height) + ": dimensions must be positive.");
+    if (frame == -1 || frame >= num_frames[PostSource])
+        return sourceFrameTime(num_frames[PostSource]);
 
-    resize.width = new_width;
-    resize.height = new_height;
-}
+    int cycle = frame / 5;
 
+    double start_time, end_time;
+    int surviving;
+    getCycleTiming(cycle, start_time, end_time, surviving);
 
-void WobblyProject::setResizeEnabled(bool enabled) {
-    resize.enabled = enabled;
+    int before = 0;
+    for (int i = 0; i < frame % 5; i++)
+        if (!(decimation->frames[cycle] & (1 << i)))
+            before++;
+
+    return start_time + (end_time - start_time) * before / surviving;
 }
 
 
-bool WobblyProject::isResizeEnabled() {
-    return resize.enabled;
-}
+int WobblyProject::secondsToFrame(double seconds) {
+    if (num_frames[PostSource] == 0)
+        return -1;
 
+    if (timing_dirty)
+        updateTiming();
 
-void WobblyProject::setCrop(int left, int top, int right, int bottom) {
-    if (left < 0 || top < 0 || right < 0 || bottom < 0)
-        throw WobblyException("Can't crop (" + std::to_string(left) + "," + std::to_string(top) + "," + std::to_string(right) + "," + std::to_string(bottom) + "): negative values.");
+    // Source frame first, from the segment's frame rate.
+    size_t segment = std::upper_bound(timing_times.cbegin(), timing_times.cend(), seconds) - timing_times.cbegin();
+    if (segment > 0)
+        segment--;
 
-    crop.left = left;
-    crop.top = top;
-    crop.right = right;
-    crop.bottom = bottom;
-}
+    double position = timing_starts[segment];
+    if (timing_durations[segment] > 0)
+        position += (seconds - timing_times[segment]) / timing_durations[segment];
 
+    int frame = (int)std::max(0.0, std::min(position, (double)(num_frames[PostSource] - 1)));
 
-void WobblyProject::setCropEnabled(bool enabled) {
-    crop.enabled = enabled;
-}
+    // Rounding can put the time just outside the cycle.
+    int cycle = frame / 5;
+    while (cycle > 0 && sourceFrameTime(cycle * 5) > seconds)
+        cycle--;
+    while ((cycle + 1) * 5 < num_frames[PostSource] && sourceFrameTime((cycle + 1) * 5) <= seconds)
+        cycle++;
+
+    double start_time, end_time;
+    int surviving;
+    getCycleTiming(cycle, start_time, end_time, surviving);
+
+    // A cycle without surviving frames keeps its time, so the frame before it stays on screen.
+    if (surviving == 0) {
+        int previous = findPreviousSurvivingFrame(cycle * 5);
+        return previous != -1 ? previous : findNextSurvivingFrame(cycle * 5);
+    }
 
+    // Same arithmetic as frameToSeconds, so the two agree exactly.
+    int index = 0;
+    while (index + 1 < surviving && start_time + (end_time - start_time) * (index + 1) / surviving <= seconds)
+        index++;
 
-bool WobblyProject::isCropEnabled() {
-    return crop.enabled;
+    for (int i = 0; i < 5; i++) {
+        if (!(decimation->frames[cycle] & (1 << i))) {
+            if (index == 0)
+                return cycle * 5 + i;
+            index--;
+        }
+    }
+
+    return -1;
 }
 
 
 std::string WobblyProject::frameToTime(int frame) {
-    int milliseconds = (int)((frame * fps_den * 1000 / fps_num) % 1000);
-    int seconds_total = (int)(frame * fps_den / fps_num);
+    double time = frameToSeconds(frame);
+
+    // Rounded to microseconds first, so 1.001 doesn't come out as 1.000.
+    int64_t milliseconds_total = std::llround(time * 1000000) / 1000;
+    int milliseconds = (int)(milliseconds_total % 1000);
+    int seconds_total = (int)(milliseconds_total / 1000);
     int seconds = seconds_total % 60;
     int minutes = (seconds_total / 60) % 60;
     int hours = seconds_total / 3600;
 
-    char time[16];
+    char time_string[32];
 #ifdef _MSC_VER
     _snprintf
 #else
     snprintf
 #endif
-            (time, sizeof(time), "%02d:%02d:%02d.%03d", hours, minutes, seconds, milliseconds);
-    time[15] = '\0';
+            (time_string, sizeof(time_string), "%02d:%02d:%02d.%03d", hours, minutes, seconds, milliseconds);
+
+    return std::string(time_string);
+}
+
+
+void WobblyProject::writeTimecodes(const std::string &path) {
+    QSaveFile file(QString::fromStdString(path));
+
+    if (!file.open(QIODevice::WriteOnly))
+        throw WobblyException("Couldn't open timecodes file. Error message: " + file.errorString().toStdString());
+
+    // Not locale-dependent.
+    std::ostringstream timecodes;
+    timecodes.imbue(std::locale::classic());
+    timecodes.setf(std::ios::fixed);
+    timecodes.precision(6);
+
+    timecodes << "# timecode format v2\n";
+
+    int num_cycles = (num_frames[PostSource] + 4) / 5;
+
+    for (int cycle = 0; cycle < num_cycles; cycle++) {
+        double start_time, end_time;
+        int surviving;
+        getCycleTiming(cycle, start_time, end_time, surviving);
+
+        for (int i = 0; i < surviving; i++)
+            timecodes << (start_time + (end_time - start_time) * i / surviving) * 1000 << '\n';
+    }
+
+    std::string contents = timecodes.str();
 
-    return std::string(time);
+    if (file.write(contents.data(), contents.size()) != (qint64)contents.size())
+        throw WobblyException("Failed to write timecodes file. Error message: " + file.errorString().toStdString());
+
+    if (!file.commit())
+        throw WobblyException("Couldn't save timecodes file. Error message: " + file.errorString().toStdString());
 }
 
 
@@ -775,232 +3094,323 @@ int WobblyProject::frameNumberAfterDecimation(int frame) {
 
     int position_in_cycle = frame % 5;
 
-    int out_frame = cycle_number * 5;
-
-    for (int i = 0; i < cycle_number; i++)
-        out_frame -= decimated_frames[i].size();
+    int out_frame = cycle_number * 5 - decimation->counts.prefixSum(cycle_number);
 
-    for (int8_t i = 0; i < position_in_cycle; i++)
-        if (!decimated_frames[cycle_number].count(i))
+    for (int i = 0; i < position_in_cycle; i++)
+        if (!(decimation->frames[cycle_number] & (1 << i)))
             out_frame++;
 
     return out_frame;
 }
 
 
-void WobblyProject::guessSectionPatternsFromMatches(int section_start, int use_third_n_match, int drop_duplicate) {
-    int section_end = getSectionEnd(section_start);
+int WobblyProject::frameNumberBeforeDecimation(int frame) {
+    if (num_frames[PostDecimate] == 0)
+        return 0;
+
+    if (frame < 0)
+        frame = 0;
+
+    if (frame >= num_frames[PostDecimate])
+        frame = num_frames[PostDecimate] - 1;
 
-    // Count the "nc" pairs in each position.
-    int positions[5] = { 0 };
-    int total = 0;
+    // The cycle is the last one with at most frame surviving frames before it.
+    int cycle_number = decimation->counts.search([frame] (int decimated, int cycles) {
+        return cycles * 5 - decimated <= frame;
+    });
 
-    for (int i = section_start; i < std::min(section_end, num_frames[PostSource] - 1); i++) {
-        if (original_matches[i] == 'n' && original_matches[i + 1] == 'c') {
-            positions[i % 5]++;
-            total++;
+    int remaining = frame - (cycle_number * 5 - decimation->counts.prefixSum(cycle_number));
+
+    int position_in_cycle = 0;
+    for (; position_in_cycle < 4; position_in_cycle++) {
+        if (!(decimation->frames[cycle_number] & (1 << position_in_cycle))) {
+            if (remaining == 0)
+                break;
+            remaining--;
         }
     }
 
-    // Find the two positions with the most "nc" pairs.
-    int best = 0;
-    int next_best = 0;
-    int tmp = -1;
+    return cycle_number * 5 + position_in_cycle;
+}
 
-    for (int i = 0; i < 5; i++)
-        if (positions[i] > tmp) {
-            tmp = positions[i];
-            best = i;
-        }
 
-    tmp = -1;
+int WobblyProject::findNextSurvivingFrame(int frame) {
+    if (frame < 0)
+        frame = 0;
 
-    for (int i = 0; i < 5; i++) {
-        if (i == best)
-            continue;
+    if (frame >= num_frames[PostSource])
+        return -1;
+
+    int out_frame = frameNumberAfterDecimation(frame);
+
+    if (out_frame >= num_frames[PostDecimate])
+        return -1;
+
+    return frameNumberBeforeDecimation(out_frame);
+}
+
+
+int WobblyProject::findPreviousSurvivingFrame(int frame) {
+    if (frame >= num_frames[PostSource])
+        frame = num_frames[PostSource] - 1;
+
+    if (frame < 0)
+        return -1;
+
+    if (!isDecimatedFrame(frame))
+        return frame;
+
+    int out_frame = frameNumberAfterDecimation(frame);
+
+    if (out_frame == 0)
+        return -1;
+
+    return frameNumberBeforeDecimation(out_frame - 1);
+}
+
+
+void WobblyProject::guessSectionPatternsFromMatches(int section_start, int use_third_n_match, int drop_duplicate) {
+    int section_end = getSectionEnd(section_start);
 
-        if (positions[i] > tmp) {
-            tmp = positions[i];
-            next_best = i;
+    atomicChange([&] () {
+        // Count the "nc" pairs in each position.
+        int positions[5] = { 0 };
+        int total = 0;
+
+        for (int i = section_start; i < std::min(section_end, num_frames[PostSource] - 1); i++) {
+            if (original_matches->get(i) == 'n' && original_matches->get(i + 1) == 'c') {
+                positions[i % 5]++;
+                total++;
+            }
         }
-    }
 
-    float best_percent = 0.0f;
-    float next_best_percent = 0.0f;
+        // Find the two positions with the most "nc" pairs.
+        int best = 0;
+        int next_best = 0;
+        int tmp = -1;
 
-    if (total > 0) {
-        best_percent = positions[best] * 100 / (float)total;
-        next_best_percent = positions[next_best] * 100 / (float)total;
-    }
+        for (int i = 0; i < 5; i++)
+            if (positions[i] > tmp) {
+                tmp = positions[i];
+                best = i;
+            }
+
+        tmp = -1;
 
-    // Totally arbitrary thresholds.
-    if (best_percent > 40.0f && best_percent - next_best_percent > 10.0f) {
-        // Take care of decimation first.
+        for (int i = 0; i < 5; i++) {
+            if (i == best)
+                continue;
 
-        // If the first duplicate is the last frame in the cycle, we have to drop the same duplicate in the entire section.
-        if (drop_duplicate == DropUglierDuplicatePerCycle && best == 4)
-            drop_duplicate = DropUglierDuplicatePerSection;
+            if (positions[i] > tmp) {
+                tmp = positions[i];
+                next_best = i;
+            }
+        }
 
-        int drop = -1;
+        float best_percent = 0.0f;
+        float next_best_percent = 0.0f;
 
-        if (drop_duplicate == DropUglierDuplicatePerSection) {
-            // Find the uglier duplicate.
-            int drop_n = 0;
-            int drop_c = 0;
+        if (total > 0) {
+            best_percent = positions[best] * 100 / (float)total;
+            next_best_percent = positions[next_best] * 100 / (float)total;
+        }
 
-            for (int i = section_start; i < std::min(section_end, num_frames[PostSource] - 1); i++) {
-                if (i % 5 == best) {
-                    int16_t mic_n = mics[i][2];
-                    int16_t mic_c = mics[i + 1][1];
-                    if (mic_n > mic_c)
-                        drop_n++;
-                    else
-                        drop_c++;
+        // Totally arbitrary thresholds.
+        if (best_percent > 40.0f && best_percent - next_best_percent > 10.0f) {
+            // Take care of decimation first.
+
+            // If the first duplicate is the last frame in the cycle, we have to drop the same duplicate in the entire section.
+            if (drop_duplicate == DropUglierDuplicatePerCycle && best == 4)
+                drop_duplicate = DropUglierDuplicatePerSection;
+
+            int drop = -1;
+
+            if (drop_duplicate == DropUglierDuplicatePerSection) {
+                // Find the uglier duplicate.
+                int drop_n = 0;
+                int drop_c = 0;
+
+                for (int i = section_start; i < std::min(section_end, num_frames[PostSource] - 1); i++) {
+                    if (i % 5 == best) {
+                        int16_t mic_n = getMic(i, 2);
+                        int16_t mic_c = getMic(i + 1, 1);
+                        if (mic_n > mic_c)
+                            drop_n++;
+                        else
+                            drop_c++;
+                    }
                 }
-            }
 
-            if (drop_n > drop_c)
+                if (drop_n > drop_c)
+                    drop = best;
+                else
+                    drop = (best + 1) % 5;
+            } else if (drop_duplicate == DropFirstDuplicate) {
                 drop = best;
-            else
+            } else if (drop_duplicate == DropSecondDuplicate) {
                 drop = (best + 1) % 5;
-        } else if (drop_duplicate == DropFirstDuplicate) {
-            drop = best;
-        } else if (drop_duplicate == DropSecondDuplicate) {
-            drop = (best + 1) % 5;
-        }
+            }
 
-        int first_cycle = section_start / 5;
-        int last_cycle = (section_end - 1) / 5;
-        for (int i = first_cycle; i < last_cycle + 1; i++) {
-            if (drop_duplicate == DropUglierDuplicatePerCycle) {
-                if (i == first_cycle) {
-                    if (section_start % 5 > best + 1)
-                        continue;
-                    else if (section_start % 5 > best)
-                        drop = best + 1;
-                } else if (i == last_cycle) {
-                    if ((section_end - 1) % 5 < best)
-                        continue;
-                    else if ((section_end - 1) % 5 < best + 1)
-                        drop = best;
-                }
+            int first_cycle = section_start / 5;
+            int last_cycle = (section_end - 1) / 5;
+            for (int i = first_cycle; i < last_cycle + 1; i++) {
+                if (drop_duplicate == DropUglierDuplicatePerCycle) {
+                    if (i == first_cycle) {
+                        if (section_start % 5 > best + 1)
+                            continue;
+                        else if (section_start % 5 > best)
+                            drop = best + 1;
+                    } else if (i == last_cycle) {
+                        if ((section_end - 1) % 5 < best)
+                            continue;
+                        else if ((section_end - 1) % 5 < best + 1)
+                            drop = best;
+                    }
 
-                if (drop == -1) {
-                    int16_t mic_n = mics[i * 5 + best][2];
-                    int16_t mic_c = mics[i * 5 + best + 1][1];
-                    if (mic_n > mic_c)
-                        drop = best;
-                    else
-                        drop = (best + 1) % 5;
+                    if (drop == -1) {
+                        int16_t mic_n = getMic(i * 5 + best, 2);
+                        int16_t mic_c = getMic(i * 5 + best + 1, 1);
+                        if (mic_n > mic_c)
+                            drop = best;
+                        else
+                            drop = (best + 1) % 5;
+                    }
                 }
-            }
 
-            // At this point we know what frame to drop in this cycle.
+                // At this point we know what frame to drop in this cycle.
+
+                if (i == first_cycle) {
+                    // See if the cycle has a decimated frame from the previous section.
 
-            if (i == first_cycle) {
-                // See if the cycle has a decimated frame from the previous section.
+                    /*
+                    bool conflicting_patterns = false;
 
-                /*
-                bool conflicting_patterns = false;
+                    for (int j = i * 5; j < section_start; j++)
+                        if (isDecimatedFrame(j)) {
+                            conflicting_patterns = true;
+                            break;
+                        }
 
-                for (int j = i * 5; j < section_start; j++)
-                    if (isDecimatedFrame(j)) {
-                        conflicting_patterns = true;
-                        break;
+                    if (conflicting_patterns) {
+                        // If 18 fps cycles are not wanted, try to decimate from the side with more motion.
                     }
+                    */
 
-                if (conflicting_patterns) {
-                    // If 18 fps cycles are not wanted, try to decimate from the side with more motion.
+                    // Clear decimated frames in the cycle, but only from this section.
+                    for (int j = section_start; j < (i + 1) * 5; j++)
+                        if (isDecimatedFrame(j))
+                            deleteDecimatedFrame(j);
+                } else if (i == last_cycle) {
+                    // See if the cycle has a decimated frame from the next section.
+
+                    // Clear decimated frames in the cycle, but only from this section.
+                    for (int j = i * 5; j < section_end; j++)
+                        if (isDecimatedFrame(j))
+                            deleteDecimatedFrame(j);
+                } else {
+                    clearDecimatedFramesFromCycle(i * 5);
                 }
-                */
-
-                // Clear decimated frames in the cycle, but only from this section.
-                for (int j = section_start; j < (i + 1) * 5; j++)
-                    if (isDecimatedFrame(j))
-                        deleteDecimatedFrame(j);
-            } else if (i == last_cycle) {
-                // See if the cycle has a decimated frame from the next section.
-
-                // Clear decimated frames in the cycle, but only from this section.
-                for (int j = i * 5; j < section_end; j++)
-                    if (isDecimatedFrame(j))
-                        deleteDecimatedFrame(j);
-            } else {
-                clearDecimatedFramesFromCycle(i * 5);
+
+                // The last cycle can end before the frame to drop, in this section or in the video.
+                if (i * 5 + drop < section_end)
+                    addDecimatedFrame(i * 5 + drop);
             }
 
-            addDecimatedFrame(i * 5 + drop);
-        }
 
+            // Now the matches.
+            std::string patterns[5] = { "ncccn", "nnccc", "cnncc", "ccnnc", "cccnn" };
+            if (use_third_n_match == UseThirdNMatchAlways)
+                for (int i = 0; i < 5; i++)
+                    patterns[i][(i + 3) % 5] = 'n';
 
-        // Now the matches.
-        std::string patterns[5] = { "ncccn", "nnccc", "cnncc", "ccnnc", "cccnn" };
-        if (use_third_n_match == UseThirdNMatchAlways)
-            for (int i = 0; i < 5; i++)
-                patterns[i][(i + 3) % 5] = 'n';
+            const std::string &pattern = patterns[best];
 
-        const std::string &pattern = patterns[best];
+            undoRecordMatches(section_start, section_end - 1);
 
-        for (int i = section_start; i < section_end; i++) {
-            if (use_third_n_match == UseThirdNMatchIfPrettier && pattern[i % 5] == 'c' && pattern[(i + 1) % 5] == 'n') {
-                int16_t mic_n = mics[i][2];
-                int16_t mic_c = mics[i][1];
-                if (mic_n < mic_c)
-                    matches[i] = 'n';
-                else
-                    matches[i] = 'c';
-            } else {
-                matches[i] = pattern[i % 5];
+            matches.setPattern(section_start, section_end - 1, 0, pattern);
+
+            if (use_third_n_match == UseThirdNMatchIfPrettier) {
+                for (int i = section_start; i < section_end; i++) {
+                    if (pattern[i % 5] == 'c' && pattern[(i + 1) % 5] == 'n') {
+                        int16_t mic_n = getMic(i, 2);
+                        int16_t mic_c = getMic(i, 1);
+                        if (mic_n < mic_c)
+                            matches.set(i, 'n', original_matches->get(i));
+                    }
+                }
             }
+
+            // If the last frame of the section has much higher mic with c/n matches than with p match, use the p match.
+            char match_index = matchCharToIndex(getMatch(section_end - 1));
+            int16_t mic_cn = getMic(section_end - 1, match_index);
+            int16_t mic_p = getMic(section_end - 1, 0);
+            if (mic_cn > mic_p * 2)
+                matches.set(section_end - 1, 'p', original_matches->get(section_end - 1));
+
+            notifyChange(ChangeMatches, section_start, section_end - 1);
         }
+    });
 
-        // If the last frame of the section has much higher mic with c/n matches than with p match, use the p match.
-        char match_index = matchCharToIndex(matches[section_end - 1]);
-        int16_t mic_cn = mics[section_end - 1][match_index];
-        int16_t mic_p = mics[section_end - 1][0];
-        if (mic_cn > mic_p * 2)
-            matches[section_end - 1] = 'p';
-    }
+    journalRecord("guessSectionPatternsFromMatches", section_start, use_third_n_match, drop_duplicate);
 }
 
 
 void WobblyProject::guessProjectPatternsFromMatches(int minimum_length, int use_third_n_match, int drop_duplicate) {
-    for (auto it = sections.cbegin(); it != sections.cend(); it++) {
-        int length = getSectionEnd(it->second.start) - it->second.start;
+    atomicChange([&] () {
+        for (auto it = sections.cbegin(); it != sections.cend(); it++) {
+            int length = getSectionEnd(it->second.start) - it->second.start;
 
-        if (length < minimum_length)
-            // XXX Record the sections skipped due to their length.
-            continue;
+            if (length < minimum_length)
+                // XXX Record the sections skipped due to their length.
+                continue;
 
-        // XXX Record the sections where the matches didn't reveal a pattern.
-        guessSectionPatternsFromMatches(it->second.start, use_third_n_match, drop_duplicate);
-    }
+            // XXX Record the sections where the matches didn't reveal a pattern.
+            guessSectionPatternsFromMatches(it->second.start, use_third_n_match, drop_duplicate);
+        }
+    });
+
+    journalRecord("guessProjectPatternsFromMatches", minimum_length, use_third_n_match, drop_duplicate);
 }
 
 
 void WobblyProject::sectionsToScript(std::string &script) {
-    // XXX Make a temporary copy of the sections map and merge sections with identical presets, to generate as few trims as possible.
+    // Adjacent sections with identical presets become one trim. Comparing the preset ids is enough.
+    std::vector<const Section *> runs;
+    for (auto it = sections.cbegin(); it != sections.cend(); it++)
+        if (runs.empty() || runs.back()->presets != it->second.presets)
+            runs.push_back(&it->second);
+
+    // A single trim would be the whole clip, so there is nothing to splice.
+    if (runs.size() < 2) {
+        if (runs.empty() || runs[0]->presets.empty())
+            return;
+
+        for (size_t i = 0; i < runs[0]->presets.size(); i++)
+            script += "src = " + preset_names[runs[0]->presets[i]] + "(src)\n";
+        script += "\n";
+
+        return;
+    }
+
     std::string splice = "src = c.std.Splice(mismatch=True, clips=[";
-    for (auto it = sections.cbegin(); it != sections.cend(); it++) {
+    for (size_t r = 0; r < runs.size(); r++) {
         std::string section_name = "section";
-        section_name += std::to_string(it->second.start);
+        section_name += std::to_string(runs[r]->start);
         script += section_name + " = src";
 
-        for (size_t i = 0; i < it->second.presets.size(); i++) {
+        for (size_t i = 0; i < runs[r]->presets.size(); i++) {
             script += "\n";
             script += section_name + " = ";
-            script += it->second.presets[i] + "(";
+            script += preset_names[runs[r]->presets[i]] + "(";
             script += section_name + ")";
         }
 
         script += "[";
-        script += std::to_string(it->second.start);
+        script += std::to_string(runs[r]->start);
         script += ":";
 
-        auto it_next = it;
-        it_next++;
-        if (it_next != sections.cend())
-            script += std::to_string(it_next->second.start);
+        if (r + 1 < runs.size())
+            script += std::to_string(runs[r + 1]->start);
         script += "]\n";
 
         splice += section_name + ",";
@@ -1023,13 +3433,13 @@ void WobblyProject::customListsToScript(std::string &script, PositionInFilterCha
             continue;
 
         // Complain if the custom list doesn't have a preset assigned.
-        if (!custom_lists[i].preset.size())
+        if (custom_lists[i].preset == -1)
             throw WobblyException("Custom list '" + custom_lists[i].name + "' has no preset assigned.");
 
         std::string list_name = "cl_";
         list_name += custom_lists[i].name;
 
-        script += list_name + " = " + custom_lists[i].preset + "(src)\n";
+        script += list_name + " = " + preset_names[custom_lists[i].preset] + "(src)\n";
 
         std::string splice = "src = c.std.Splice(mismatch=True, clips=[";
 
@@ -1109,7 +3519,9 @@ void WobblyProject::fieldHintToScript(std::string &script) {
     script += "src = c.fh.FieldHint(clip=src, tff=";
     script += std::to_string((int)vfm_parameters["order"]);
     script += ", matches='";
-    script.append(matches.data(), matches.size());
+    size_t matches_start = script.size();
+    original_matches->appendTo(script);
+    matches.apply(script, matches_start);
     script +=
             "')\n"
             "\n";
@@ -1139,11 +3551,100 @@ void WobblyProject::freezeFramesToScript(std::string &script) {
 }
 
 void WobblyProject::decimatedFramesToScript(std::string &script) {
-    script += "src = c.std.DeleteFrames(clip=src, frames=[";
+    // Long runs of cycles with the same pattern become SelectEvery. The cycles in between are
+    // listed in DeleteFrames, like before. A run shorter than this takes more script than the list.
+    const int minimum_run = 10;
+
+    const std::vector<uint8_t> &decimated_frames = decimation->frames;
+
+    int num_cycles = (int)decimated_frames.size();
+
+    auto trim = [&] (int first_cycle, int end_cycle) {
+        if (first_cycle == 0 && end_cycle == num_cycles)
+            return std::string("src");
+
+        std::string clip = "src[" + std::to_string(first_cycle * 5) + ":";
+        if (end_cycle < num_cycles)
+            clip += std::to_string(end_cycle * 5);
+        return clip + "]";
+    };
+
+    auto deleteFrames = [&] (int first_cycle, int end_cycle, int &deleted) {
+        std::string frames;
+        deleted = 0;
+
+        for (int i = first_cycle; i < end_cycle; i++)
+            for (int j = 0; j < 5; j++)
+                if (decimated_frames[i] & (1 << j)) {
+                    frames += std::to_string((i - first_cycle) * 5 + j) + ",";
+                    deleted++;
+                }
+
+        if (!deleted)
+            return trim(first_cycle, end_cycle);
+
+        return "c.std.DeleteFrames(clip=" + trim(first_cycle, end_cycle) + ", frames=[" + frames + "])";
+    };
+
+    std::vector<std::string> clips;
+    int irregular_start = 0;
 
-    for (size_t i = 0; i < decimated_frames.size(); i++)
-        for (auto it = decimated_frames[i].cbegin(); it != decimated_frames[i].cend(); it++)
-            script += std::to_string(i * 5 + *it) + ",";
+    auto addIrregularCycles = [&] (int end_cycle) {
+        if (irregular_start == end_cycle)
+            return;
+
+        int deleted;
+        std::string clip = deleteFrames(irregular_start, end_cycle, deleted);
+
+        // Nothing left of these cycles.
+        if (deleted < std::min(end_cycle * 5, num_frames[PostSource]) - irregular_start * 5)
+            clips.push_back(clip);
+    };
+
+    for (int start = 0; start < num_cycles; ) {
+        int end = start + 1;
+        while (end < num_cycles && decimated_frames[end] == decimated_frames[start])
+            end++;
+
+        if (end - start >= minimum_run) {
+            addIrregularCycles(start);
+            irregular_start = end;
+
+            // Nothing to select when no frame is dropped, and nothing left when all of them are.
+            uint8_t cycle = decimated_frames[start];
+
+            if (cycle == 0) {
+                clips.push_back(trim(start, end));
+            } else if (cycle != 0x1f) {
+                std::string offsets;
+                for (int j = 0; j < 5; j++)
+                    if (!(cycle & (1 << j)))
+                        offsets += std::to_string(j) + ",";
+
+                clips.push_back("c.std.SelectEvery(clip=" + trim(start, end) + ", cycle=5, offsets=[" + offsets + "])");
+            }
+        }
+
+        start = end;
+    }
+
+    addIrregularCycles(num_cycles);
+
+    if (clips.empty()) {
+        // Every frame is decimated. Let DeleteFrames complain about it.
+        int deleted;
+        clips.push_back(deleteFrames(0, num_cycles, deleted));
+    }
+
+    if (clips.size() == 1) {
+        script += "src = " + clips[0] + "\n\n";
+        return;
+    }
+
+    script += "src = c.std.Splice(clips=[";
+
+    for (size_t i = 0; i < clips.size(); i++)
+        script += clips[i] + ",";
 
     script +=
             "])\n"
@@ -1184,48 +3685,153 @@ void WobblyProject::setOutputToScript(std::string &script) {
     script += "src.set_output()\n";
 }
 
+void WobblyProject::invalidateScriptFragments() {
+    script_fragments_valid.fill(false);
+}
+
+
+void WobblyProject::updateScriptFragments(ChangeType type, int first, int last) {
+    switch (type) {
+        case ChangeMatches:
+            // The matches are patched in place, so one changed match doesn't mean copying all of them.
+            if (script_fragments_valid[FragmentFieldHint] && first <= last) {
+                std::string &fragment = script_fragments[FragmentFieldHint];
+
+                for (int i = first; i <= last; i++)
+                    fragment[fieldhint_matches_offset + i] = original_matches->get(i);
+
+                std::vector<MatchRun> runs;
+                matches.getRange(first, last, runs);
+                for (size_t i = 0; i < runs.size(); i++)
+                    for (int j = runs[i].first; j <= runs[i].last; j++)
+                        fragment[fieldhint_matches_offset + j] = runs[i].get(j);
+            }
+            break;
+        case ChangeDecimation:
+            script_fragments_valid[FragmentDecimatedFrames] = false;
+            break;
+        case ChangeCombedFrames:
+            break;
+        case ChangeFreezeFrames:
+            script_fragments_valid[FragmentFreezeFrames] = false;
+            break;
+        case ChangeSections:
+            script_fragments_valid[FragmentSections] = false;
+            break;
+        case ChangePresets:
+            // The sections and custom lists call the presets by name.
+            script_fragments_valid[FragmentPresets] = false;
+            script_fragments_valid[FragmentSections] = false;
+            // Fall through.
+        case ChangeCustomLists:
+            script_fragments_valid[FragmentCustomListsPostSource] = false;
+            script_fragments_valid[FragmentCustomListsPostFieldMatch] = false;
+            script_fragments_valid[FragmentCustomListsPostDecimate] = false;
+            break;
+        case ChangeCropResize:
+            script_fragments_valid[FragmentCrop] = false;
+            script_fragments_valid[FragmentShowCrop] = false;
+            script_fragments_valid[FragmentResize] = false;
+            break;
+    }
+}
+
+
+const std::string &WobblyProject::getScriptFragment(ScriptFragment fragment) {
+    std::string &script = script_fragments[fragment];
+
+    if (script_fragments_valid[fragment])
+        return script;
+
+    script.clear();
+
+    switch (fragment) {
+        case FragmentPresets:
+            presetsToScript(script);
+            break;
+        case FragmentSource:
+            sourceToScript(script);
+            break;
+        case FragmentTrim:
+            trimToScript(script);
+            break;
+        case FragmentCustomListsPostSource:
+            customListsToScript(script, PostSource);
+            break;
+        case FragmentFieldHint:
+            fieldHintToScript(script);
+            fieldhint_matches_offset = script.find("matches='") + 9;
+            break;
+        case FragmentSections:
+            sectionsToScript(script);
+            break;
+        case FragmentCustomListsPostFieldMatch:
+            customListsToScript(script, PostFieldMatch);
+            break;
+        case FragmentFreezeFrames:
+            freezeFramesToScript(script);
+            break;
+        case FragmentDecimatedFrames:
+            decimatedFramesToScript(script);
+            break;
+        case FragmentCustomListsPostDecimate:
+            customListsToScript(script, PostDecimate);
+            break;
+        case FragmentCrop:
+            cropToScript(script);
+            break;
+        case FragmentShowCrop:
+            showCropToScript(script);
+            break;
+        case FragmentResize:
+            resizeToScript(script);
+            break;
+        case NumScriptFragments:
+            break;
+    }
+
+    script_fragments_valid[fragment] = true;
+
+    return script;
+}
+
+
 std::string WobblyProject::generateFinalScript(bool for_preview) {
     // XXX Insert comments before and after each part.
     std::string script;
 
     headerToScript(script);
 
-    presetsToScript(script);
+    script += getScriptFragment(FragmentPresets);
 
-    sourceToScript(script);
+    script += getScriptFragment(FragmentSource);
 
-    trimToScript(script);
+    script += getScriptFragment(FragmentTrim);
 
-    customListsToScript(script, PostSource);
+    script += getScriptFragment(FragmentCustomListsPostSource);
 
-    fieldHintToScript(script);
+    script += getScriptFragment(FragmentFieldHint);
 
     // XXX Put them and FreezeFrames in the same order as Yatta does.
-    sectionsToScript(script);
+    script += getScriptFragment(FragmentSections);
 
-    customListsToScript(script, PostFieldMatch);
+    script += getScriptFragment(FragmentCustomListsPostFieldMatch);
 
     if (frozen_frames.size())
-        freezeFramesToScript(script);
+        script += getScriptFragment(FragmentFreezeFrames);
 
-    bool decimation_needed = false;
-    for (size_t i = 0; i < decimated_frames.size(); i++)
-        if (decimated_frames[i].size()) {
-            decimation_needed = true;
-            break;
-        }
-    if (decimation_needed)
-        decimatedFramesToScript(script);
+    if (num_frames[PostDecimate] != num_frames[PostSource])
+        script += getScriptFragment(FragmentDecimatedFrames);
 
     // XXX DeleteFrames doesn't change the frame rate or the frame durations. This must be done separately.
 
-    customListsToScript(script, PostDecimate);
+    script += getScriptFragment(FragmentCustomListsPostDecimate);
 
     if (crop.enabled)
-        cropToScript(script);
+        script += getScriptFragment(FragmentCrop);
 
     if (resize.enabled)
-        resizeToScript(script);
+        script += getScriptFragment(FragmentResize);
 
     // Maybe this doesn't belong here after all.
     if (for_preview)
@@ -1243,18 +3849,18 @@ std::string WobblyProject::generateMainDisplayScript(bool show_crop) {
 
     headerToScript(script);
 
-    sourceToScript(script);
+    script += getScriptFragment(FragmentSource);
 
-    trimToScript(script);
+    script += getScriptFragment(FragmentTrim);
 
-    fieldHintToScript(script);
+    script += getScriptFragment(FragmentFieldHint);
 
     if (frozen_frames.size())
-        freezeFramesToScript(script);
+        script += getScriptFragment(FragmentFreezeFrames);
 
     if (show_crop && crop.enabled) {
-        cropToScript(script);
-        showCropToScript(script);
+        script += getScriptFragment(FragmentCrop);
+        script += getScriptFragment(FragmentShowCrop);
     }
 
     rgbConversionToScript(script);
@@ -10,12 +10,31 @@
 #include <set>
 
 #include <array>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <string>
 
+#include "FenwickTree.h"
+#include "FrameBitset.h"
+#include "FrameColumns.h"
+#include "IntervalIndex.h"
+#include "JsonReader.h"
+#include "MatchOverrides.h"
+#include "PackedMatches.h"
+#include "ProjectJournal.h"
 #include "WobblyException.h"
 
 
+class QSaveFile;
+
+
+// Version 1: matches as arrays of one-character strings, decimated and combed frames as lists of frame numbers.
+// Version 2: matches as strings, decimated frames as runs of per-cycle bitmasks, combed frames as ranges.
+// Version 3: only the matches that differ from the original matches, as runs of patterns.
+#define PROJECT_FORMAT_VERSION 3
+
+
 /*
 static const char[] match_chars = { 'p', 'c', 'n', 'b', 'u' };
 
@@ -30,22 +49,6 @@ enum Matches {
 */
 
 
-static inline uint8_t matchCharToIndex(char match) {
-    if (match == 'p')
-        return 0;
-    if (match == 'c')
-        return 1;
-    if (match == 'n')
-        return 2;
-    if (match == 'b')
-        return 3;
-    if (match == 'u')
-        return 4;
-
-    return 255;
-}
-
-
 struct FreezeFrame {
     int first;
     int last;
@@ -54,6 +57,7 @@ struct FreezeFrame {
 
 
 struct Preset {
+    int id; // Sections and custom lists refer to the preset by this.
     std::string name; // Must be suitable for use as Python function name.
     std::string contents;
 };
@@ -61,8 +65,8 @@ struct Preset {
 
 struct Section {
     int start;
-    std::vector<std::string> presets; // Preset names, in user-defined order.
-    int64_t fps_num;
+    std::vector<int> presets; // Preset ids, in user-defined order.
+    int64_t fps_num; // Rate of the section's source frames, before decimation. 0 means the project's input frame rate.
     int64_t fps_den;
     int num_frames; // If the presets don't change the frame count, this is the same as the original number of frames. Or -1?
 
@@ -83,11 +87,11 @@ struct FrameRange {
 
 struct CustomList {
     std::string name;
-    std::string preset; // Preset name.
+    int preset; // Preset id, or -1.
     int position;
     std::map<int, FrameRange> frames; // Key is FrameRange::first
 
-    CustomList(const std::string &_name, const std::string &_preset = "", int _position = 0)
+    CustomList(const std::string &_name, int _preset = -1, int _position = 0)
         : name(_name)
         , preset(_preset)
         , position(_position)
@@ -97,14 +101,7 @@ struct CustomList {
         if (first > last)
             std::swap(first, last);
 
-        const FrameRange *overlap = findFrameRange(first);
-        if (!overlap)
-            overlap = findFrameRange(last);
-        if (!overlap) {
-            auto it = frames.upper_bound(first);
-            if (it != frames.cend() && it->second.first < last)
-                overlap = &it->second;
-        }
+        const FrameRange *overlap = findOverlappingRange(frames, first, last);
 
         if (overlap)
             throw WobblyException("Can't add range (" + std::to_string(first) + "," + std::to_string(last) + ") to custom list '" + name + "': overlaps (" + std::to_string(overlap->first) + "," + std::to_string(overlap->last) + ").");
@@ -118,17 +115,7 @@ struct CustomList {
     }
 
     const FrameRange *findFrameRange(int frame) const {
-        if (!frames.size())
-            return nullptr;
-
-        auto it = frames.upper_bound(frame);
-
-        it--;
-
-        if (it->second.first <= frame && frame <= it->second.last)
-            return &it->second;
-
-        return nullptr;
+        return findOverlappingRange(frames, frame, frame);
     }
 };
 
@@ -156,6 +143,33 @@ enum PositionInFilterChain {
 };
 
 
+// Interval::type in the results of findAnnotations.
+enum AnnotationType {
+    AnnotationTrim = 0,
+    AnnotationSection,
+    AnnotationFreezeFrame,
+    AnnotationCustomList
+};
+
+
+// What a change notification is about.
+enum ChangeType {
+    ChangeMatches = 0,
+    ChangeDecimation, // Every later frame moves too, after decimation.
+    ChangeCombedFrames,
+    ChangeFreezeFrames,
+    ChangeSections, // Added, deleted, or given a different preset chain.
+    ChangePresets, // The frames are the ones that use the preset.
+    ChangeCustomLists,
+    ChangeCropResize
+};
+
+
+// Frames first to last are affected. A change that affects no frames,
+// like adding a preset nothing uses yet, has last < first.
+typedef std::function<void (ChangeType type, int first, int last)> ChangeListener;
+
+
 enum UseThirdNMatch {
     UseThirdNMatchAlways,
     UseThirdNMatchNever,
@@ -187,13 +201,6 @@ class WobblyProject {
         std::unordered_map<std::string, double> vfm_parameters;
         std::unordered_map<std::string, double> vdecimate_parameters;
 
-        std::vector<std::array<int16_t, 5> > mics;
-        std::vector<char> matches;
-        std::vector<char> original_matches;
-        std::set<int> combed_frames;
-        std::vector<std::set<int8_t> > decimated_frames; // unordered_set may be sufficient.
-        std::vector<int> decimate_metrics;
-
         bool is_wobbly; // XXX Maybe only the json writing function needs to know.
 
         std::map<std::string, Preset> presets; // Key is Preset::name
@@ -207,13 +214,37 @@ class WobblyProject {
         Resize resize;
         Crop crop;
 
+        bool frame_data_file_enabled; // Store the per-frame arrays in a binary file next to the project.
+
+        bool journal_enabled; // Save only the changes, in a journal next to the project.
+
 
         // Only functions below.
 
         WobblyProject(bool _is_wobbly);
 
+        WobblyProject *createSnapshot(); // Copy that can be written from another thread. The per-frame data is shared, not copied.
+
         void writeProject(const std::string &path);
-        void readProject(const std::string &path);
+        void readProject(const std::string &path, bool lazy_metrics = false); // With lazy_metrics, the mics and decimate metrics are read on first access.
+        void recoverAutosave(const std::string &path); // Reads path + ".autosave" and saves to path. Leaves the project's journal alone.
+        void saveProject(const std::string &path); // Commits the journal if possible, otherwise writes the whole project.
+
+        void setJournalEnabled(bool enabled);
+        bool isJournalEnabled();
+        void rollbackJournal();
+        int getRecoveredJournalRecords();
+        bool isJournalStopped(); // The journal couldn't record some change. Until the next save, a crash loses everything since the last save.
+
+        bool canUndo();
+        bool canRedo();
+        void undo(); // Reverses everything done by the last call that changed the project.
+        void redo();
+
+        // Listeners hear about every change right after it's made, including the ones made by undo,
+        // redo, and reading the project. They must not add or remove listeners while being called.
+        int addChangeListener(const ChangeListener &listener); // Returns the id to remove it with.
+        void removeChangeListener(int listener_id);
 
 
         void addFreezeFrame(int first, int last, int replacement);
@@ -228,9 +259,17 @@ class WobblyProject {
         const std::string &getPresetContents(const std::string &preset_name);
         void setPresetContents(const std::string &preset_name, const std::string &preset_contents);
         void assignPresetToSection(const std::string &preset_name, int section_start);
+        int getPresetId(const std::string &preset_name);
+        const std::string &getPresetName(int preset_id);
 
 
         void setMatch(int frame, char match);
+        char getMatch(int frame);
+        char getOriginalMatch(int frame);
+
+
+        int16_t getMic(int frame, int match_index);
+        int getDecimateMetric(int frame);
 
 
         void addSection(int section_start);
@@ -241,12 +280,20 @@ class WobblyProject {
         int getSectionEnd(int frame);
         void setSectionMatchesFromPattern(int section_start, const std::string &pattern);
         void setSectionDecimationFromPattern(int section_start, const std::string &pattern);
+        void setRangeMatchesFromPattern(int start, int end, const std::string &pattern); // pattern[0] is used at start.
+        void setRangeDecimationFromPattern(int start, int end, const std::string &pattern); // 'd' drops the frame.
 
 
         void resetSectionMatches(int section_start);
         void resetRangeMatches(int start, int end);
 
 
+        // Every trim, section, freeze frame and custom list range that overlaps [first, last], all in
+        // frames after trimming. Interval::id is the custom list's index, the trim's first source
+        // frame (its key in trims), and 0 for the other types.
+        void findAnnotations(int first, int last, std::vector<Interval> &annotations);
+
+
         void addCustomList(const std::string &list_name);
         void addCustomList(const CustomList &list);
         void deleteCustomList(const std::string &list_name);
@@ -257,11 +304,17 @@ class WobblyProject {
         void deleteDecimatedFrame(int frame);
         bool isDecimatedFrame(int frame);
         void clearDecimatedFramesFromCycle(int frame);
+        void clearDecimatedFramesFromRange(int start, int end);
 
 
         void addCombedFrame(int frame);
         void deleteCombedFrame(int frame);
+        void addCombedRange(int start, int end);
+        void deleteCombedRange(int start, int end);
         bool isCombedFrame(int frame);
+        int findNextCombedFrame(int frame); // First combed frame after frame, or -1.
+        int findPreviousCombedFrame(int frame); // Last combed frame before frame, or -1.
+        int getNumCombedFrames(int first, int last);
 
 
         void setResize(int new_width, int new_height);
@@ -272,11 +325,23 @@ class WobblyProject {
         void setCropEnabled(bool enabled);
         bool isCropEnabled();
 
+        void setFrameDataFileEnabled(bool enabled);
+        bool isFrameDataFileEnabled();
 
+
+        // Times in the final output, in seconds. A cycle lasts as long as its 5 source frames, at the
+        // section's source frame rate if it has one, and is split evenly among the frames that survive
+        // decimation. A 29.97 fps section with one frame in five decimated comes out at 23.976 fps.
+        double frameToSeconds(int frame); // A decimated frame gets the time of the next surviving frame.
+        int secondsToFrame(double seconds); // The surviving frame shown at that time, or -1.
         std::string frameToTime(int frame);
+        void writeTimecodes(const std::string &path); // Timecode format v2, one line per output frame.
 
 
         int frameNumberAfterDecimation(int frame);
+        int frameNumberBeforeDecimation(int frame);
+        int findNextSurvivingFrame(int frame); // First frame at or after frame that isn't decimated, or -1.
+        int findPreviousSurvivingFrame(int frame); // Last frame at or before frame that isn't decimated, or -1.
 
 
         void guessSectionPatternsFromMatches(int section_start, int use_third_n_match, int drop_duplicate);
@@ -302,7 +367,144 @@ class WobblyProject {
         std::string generateMainDisplayScript(bool show_crop);
 
     private:
+        struct DecimatedCycles {
+            std::vector<uint8_t> frames; // One bitmask per cycle of 5 frames.
+            FenwickTree counts; // Number of decimated frames in each cycle.
+        };
+
+        // The big per-frame data is shared with snapshots, so taking one only copies pointers.
+        // Whichever project changes the shared data first gets its own copy from detach().
+        MatchOverrides matches; // Relative to original_matches.
+        std::shared_ptr<const OriginalMatches> original_matches;
+        std::shared_ptr<const FrameMetrics> metrics; // Null until loaded.
+        std::shared_ptr<FrameBitset> combed_frames;
+        std::shared_ptr<DecimatedCycles> decimation;
+
+        // Where to find the metrics when they weren't read by readProject.
+        bool metrics_in_frame_data_file;
+        std::string metrics_path; // Project file or frame data file.
+        int64_t mics_offset; // Byte offsets of the values in the project file, or -1.
+        int64_t decimate_metrics_offset;
+
+        std::string frame_data_id; // The same in the project file and in the frame data file saved with it.
+        std::string frame_data_mapping_path; // The frame data file that columns may be mapped from.
+
+        void loadMetrics();
+
+        void setCycleDecimation(int cycle, uint8_t mask, uint8_t value); // The bits in mask take their values from value.
+
+        // Indexed by preset id. Ids aren't reused, so a deleted preset leaves an empty name behind.
+        struct PresetReferences {
+            std::map<int, int> sections; // Section start -> number of times the section uses the preset.
+            std::set<int> custom_lists; // Indices.
+        };
+
+        std::vector<std::string> preset_names;
+        std::vector<PresetReferences> preset_references;
+
+        void addSectionReferences(const Section &section);
+        void deleteSectionReferences(const Section &section);
+        void moveCustomListReference(int list_index, int old_index);
+
+        IntervalIndex annotations;
+        bool annotations_dirty; // Rebuilt on the next query.
+
+        void updateAnnotations();
+
+        // One segment per section. Source frames from timing_starts[i] on last timing_durations[i] seconds each.
+        std::vector<int> timing_starts;
+        std::vector<double> timing_times; // When each segment starts.
+        std::vector<double> timing_durations; // From the source frame rate, never the decimated one.
+        bool timing_dirty; // Rebuilt on the next query.
+
+        void updateTiming();
+        size_t findTimingSegment(int frame);
+        double sourceFrameTime(int frame); // Before decimation.
+        void getCycleTiming(int cycle, double &start_time, double &end_time, int &surviving);
+
+        // Every mutation records a function that reverses it. Running that function records the
+        // opposite one, so undoing a step builds the step that redoes it, and the other way around.
+        struct UndoStep {
+            std::vector<std::function<void ()> > inverses;
+            bool in_journal; // The journal can replay it.
+        };
+
+        std::vector<UndoStep> undo_steps;
+        std::vector<UndoStep> redo_steps;
+        std::vector<std::function<void ()> > pending_inverses; // Of the call in progress.
+        int undo_paused;
+
+        struct UndoPause;
+
+        void undoRecord(const std::function<void ()> &inverse);
+        void undoRecordMatches(int first, int last); // Before the matches in [first, last] change.
+        void undoRecordDecimation(int first, int last);
+        void undoRecordCombedFrames(int first, int last);
+        void finishUndoStep();
+
+        // Runs a change made of other changes. If it throws partway, what it changed so far is
+        // reversed, so the journal never misses half of a change.
+        template <typename Function>
+        void atomicChange(Function change);
+        void rollbackPendingInverses(size_t first);
+        void applyUndoStep(std::vector<UndoStep> &from, std::vector<UndoStep> &to, const char *operation);
+
+        std::map<int, ChangeListener> change_listeners; // Key is the listener id.
+        int next_change_listener_id;
+
+        void notifyChange(ChangeType type, int first, int last); // Also updates the script fragments.
+        void notifyPresetChange(const PresetReferences &references);
+        void notifyCustomListChange(const CustomList &list);
+
+        // The parts of the scripts that depend on the project, kept between calls.
+        enum ScriptFragment {
+            FragmentPresets = 0,
+            FragmentSource,
+            FragmentTrim,
+            FragmentCustomListsPostSource,
+            FragmentFieldHint,
+            FragmentSections,
+            FragmentCustomListsPostFieldMatch,
+            FragmentFreezeFrames,
+            FragmentDecimatedFrames,
+            FragmentCustomListsPostDecimate,
+            FragmentCrop,
+            FragmentShowCrop,
+            FragmentResize,
+            NumScriptFragments
+        };
+
+        std::array<std::string, NumScriptFragments> script_fragments;
+        std::array<bool, NumScriptFragments> script_fragments_valid;
+        size_t fieldhint_matches_offset; // Where the matches start in the FieldHint fragment.
+
+        const std::string &getScriptFragment(ScriptFragment fragment);
+        void invalidateScriptFragments(); // All of them.
+        void updateScriptFragments(ChangeType type, int first, int last);
+
+        std::string journal_id; // Identifies the project file the journal belongs to.
+        std::shared_ptr<ProjectJournal> journal;
+        bool is_snapshot; // Written once, by the autosave. It gets no journal, and its frame data file isn't mapped.
+        bool journal_stopped; // Since the last save.
+        int journal_paused;
+        int journal_recovered_records;
+
+        struct JournalPause;
+
+        template <typename... Args>
+        void journalRecord(const char *operation, const Args &... args);
+        bool replayJournal(const std::string &journal_path, qint64 &valid_size, qint64 &committed_size);
+        void openJournal(const std::string &path); // Of the project file at path. Replays it, or creates it.
+        void applyJournalRecord(const std::string &operation, JsonReader &json);
+
         bool isNameSafeForPython(const std::string &name);
+
+        void readProjectFile(const std::string &path, bool lazy_metrics); // All of readProject but the journal.
+
+        void writeFrameData(QSaveFile &file, const std::string &id); // Doesn't commit.
+        void readFrameData(const std::string &path, unsigned columns, FrameMetrics &frame_metrics, OriginalMatches &file_original_matches, PackedMatches &full_matches, std::vector<int> &combed, std::vector<int> &decimated); // columns is a bitmask of column ids.
+        void mapFrameData(const std::string &path); // Serves the columns that never change from the frame data file.
+        void unmapFrameData(); // Copies the mapped columns into memory.
 };
 
 #endif // WOBBLYPROJECT_H
@@ -0,0 +1,634 @@
+// Unit tests for the shared code. Run by "make check".
+// Usage: wobbly-tests
+// The project files are written to the current directory and deleted afterwards.
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "FenwickTree.h"
+#include "FrameBitset.h"
+#include "MatchOverrides.h"
+#include "WobblyException.h"
+#include "WobblyProject.h"
+
+
+static int num_failures = 0;
+
+
+static void check(bool condition, const char *expression, const char *file, int line) {
+    if (condition)
+        return;
+
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    num_failures++;
+}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+
+static std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+
+static void writeFile(const std::string &path, const std::string &contents) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << contents;
+}
+
+
+// Deletes the project file and everything saved next to it.
+static void removeProject(const std::string &path) {
+    const char *suffixes[] = { "", ".frames", ".journal", ".autosave", ".autosave.frames" };
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+        std::remove((path + suffixes[i]).c_str());
+}
+
+
+// A project as the original Wobbly wrote it, with QJsonDocument.
+static const char baseline_project[] = R"json({
+    "combed frames": [
+        3,
+        7
+    ],
+    "crop": {
+        "bottom": 8,
+        "left": 2,
+        "right": 6,
+        "top": 4
+    },
+    "custom lists": [
+        {
+            "frames": [
+                [
+                    1,
+                    2
+                ],
+                [
+                    8,
+                    8
+                ]
+            ],
+            "name": "list",
+            "position": 1,
+            "preset": "deint"
+        }
+    ],
+    "decimate metrics": [
+        0,
+        100,
+        200,
+        300,
+        400,
+        500,
+        600,
+        700,
+        800,
+        900
+    ],
+    "decimated frames": [
+        4,
+        9
+    ],
+    "frozen frames": [
+        [
+            6,
+            6,
+            5
+        ]
+    ],
+    "input file": "source.d2v",
+    "input frame rate": [
+        30000,
+        1001
+    ],
+    "input resolution": [
+        720,
+        480
+    ],
+    "matches": [
+        "c",
+        "c",
+        "n",
+        "n",
+        "c",
+        "c",
+        "c",
+        "n",
+        "n",
+        "c"
+    ],
+    "mics": [
+        [
+            0,
+            10,
+            20,
+            30,
+            40
+        ],
+        [
+            1,
+            11,
+            21,
+            31,
+            41
+        ],
+        [
+            2,
+            12,
+            22,
+            32,
+            42
+        ],
+        [
+            3,
+            13,
+            23,
+            33,
+            43
+        ],
+        [
+            4,
+            14,
+            24,
+            34,
+            44
+        ],
+        [
+            5,
+            15,
+            25,
+            35,
+            45
+        ],
+        [
+            6,
+            16,
+            26,
+            36,
+            46
+        ],
+        [
+            7,
+            17,
+            27,
+            37,
+            47
+        ],
+        [
+            8,
+            18,
+            28,
+            38,
+            48
+        ],
+        [
+            9,
+            19,
+            29,
+            39,
+            49
+        ]
+    ],
+    "presets": [
+        {
+            "contents": "clip = c.std.Transpose(clip)\n",
+            "name": "deint"
+        }
+    ],
+    "resize": {
+        "height": 480,
+        "width": 640
+    },
+    "sections": [
+        {
+            "fps_den": 0,
+            "fps_num": 0,
+            "num_frames": 5,
+            "presets": [
+                "deint"
+            ],
+            "start": 0
+        },
+        {
+            "fps_den": 0,
+            "fps_num": 0,
+            "num_frames": 5,
+            "presets": [
+                ],
+            "start": 5
+        }
+    ],
+    "trim": [
+        [
+            0,
+            9
+        ]
+    ],
+    "vdecimate parameters": {
+        "cycle": 5
+    },
+    "vfm parameters": {
+        "mode": 0,
+        "order": 1
+    },
+    "wibbly wobbly version": 42
+}
+)json";
+
+
+// Every getter that readProject fills in, compared with what the baseline project holds.
+static void checkBaselineProject(WobblyProject &project) {
+    CHECK(project.num_frames[0] == 10);
+    CHECK(project.fps_num == 30000 && project.fps_den == 1001);
+    CHECK(project.width == 720 && project.height == 480);
+    CHECK(project.input_file == "source.d2v");
+    CHECK(project.trims.size() == 1 && project.trims.cbegin()->second.first == 0 && project.trims.cbegin()->second.last == 9);
+    CHECK(project.vfm_parameters["order"] == 1 && project.vfm_parameters["mode"] == 0);
+    CHECK(project.vdecimate_parameters["cycle"] == 5);
+
+    const char matches[] = "ccnncccnnc";
+    for (int i = 0; i < 10; i++) {
+        CHECK(project.getMatch(i) == matches[i]);
+        CHECK(project.getDecimateMetric(i) == 100 * i);
+        for (int j = 0; j < 5; j++)
+            CHECK(project.getMic(i, j) == 10 * j + i);
+        CHECK(project.isCombedFrame(i) == (i == 3 || i == 7));
+        CHECK(project.isDecimatedFrame(i) == (i == 4 || i == 9));
+    }
+
+    CHECK(project.getPresetContents("deint") == "clip = c.std.Transpose(clip)\n");
+
+    CHECK(project.sections.size() == 2);
+    const Section *section = project.findSection(0);
+    CHECK(section && section->presets.size() == 1 && project.getPresetName(section->presets[0]) == "deint");
+    section = project.findSection(5);
+    CHECK(section && section->start == 5 && section->presets.empty());
+
+    const FreezeFrame *freeze_frame = project.findFreezeFrame(6);
+    CHECK(freeze_frame && freeze_frame->first == 6 && freeze_frame->last == 6 && freeze_frame->replacement == 5);
+    CHECK(!project.findFreezeFrame(5));
+
+    CHECK(project.custom_lists.size() == 1);
+    if (project.custom_lists.size() == 1) {
+        const CustomList &list = project.custom_lists[0];
+        CHECK(list.name == "list" && list.position == 1 && project.getPresetName(list.preset) == "deint");
+        CHECK(list.frames.size() == 2 && list.findFrameRange(2) && list.findFrameRange(8) && !list.findFrameRange(3));
+    }
+
+    CHECK(project.isResizeEnabled() && project.resize.width == 640 && project.resize.height == 480);
+    CHECK(project.isCropEnabled() && project.crop.left == 2 && project.crop.top == 4 && project.crop.right == 6 && project.crop.bottom == 8);
+}
+
+
+static void testProjectRoundTrip() {
+    const std::string baseline_path = "wobbly-tests-baseline.json";
+    const std::string first_path = "wobbly-tests-first.json";
+    const std::string second_path = "wobbly-tests-second.json";
+
+    writeFile(baseline_path, baseline_project);
+
+    WobblyProject baseline(true);
+    baseline.readProject(baseline_path);
+    checkBaselineProject(baseline);
+    baseline.writeProject(first_path);
+
+    // What this version writes must read back the same, and write out the same again.
+    WobblyProject first(true);
+    first.readProject(first_path);
+    checkBaselineProject(first);
+    first.writeProject(second_path);
+
+    CHECK(readFile(first_path) == readFile(second_path));
+
+    removeProject(baseline_path);
+    removeProject(first_path);
+    removeProject(second_path);
+}
+
+
+static void testFenwickTreeSearch() {
+    // Sizes around powers of two, where the search's first step changes.
+    const size_t sizes[] = { 0, 1, 2, 7, 8, 9, 16, 33 };
+
+    for (size_t size_index = 0; size_index < sizeof(sizes) / sizeof(sizes[0]); size_index++) {
+        size_t size = sizes[size_index];
+
+        FenwickTree tree;
+        tree.assign(size);
+        CHECK(tree.size() == size);
+
+        // Runs of zeros, so several counts have the same prefix sum.
+        std::vector<int> values(size);
+        for (size_t i = 0; i < size; i++) {
+            values[i] = i % 3 == 1 ? 0 : (int)(i % 5) + 1;
+            tree.add((int)i, values[i]);
+        }
+
+        std::vector<int> prefix_sums(size + 1, 0);
+        for (size_t i = 0; i < size; i++)
+            prefix_sums[i + 1] = prefix_sums[i] + values[i];
+
+        for (size_t count = 0; count <= size; count++)
+            CHECK(tree.prefixSum((int)count) == prefix_sums[count]);
+
+        for (int target = 0; target <= prefix_sums[size] + 1; target++) {
+            int expected = 0;
+            while ((size_t)expected < size && prefix_sums[expected + 1] <= target)
+                expected++;
+
+            int found = tree.search([target] (int sum, int) {
+                return sum <= target;
+            });
+
+            CHECK(found == expected);
+        }
+
+        // The count is passed along with the sum.
+        for (size_t limit = 0; limit <= size; limit++)
+            CHECK(tree.search([limit] (int, int count) { return (size_t)count <= limit; }) == (int)limit);
+    }
+}
+
+
+// Compares rank, select, findNext and findPrevious with a plain scan of bits.
+static void checkFrameBitset(const FrameBitset &bitset, const std::vector<bool> &bits) {
+    CHECK(bitset.size() == bits.size());
+
+    std::vector<int> set_frames;
+    for (size_t i = 0; i < bits.size(); i++) {
+        CHECK(bitset.test((int)i) == bits[i]);
+        if (bits[i])
+            set_frames.push_back((int)i);
+    }
+
+    CHECK(bitset.count() == (int)set_frames.size());
+
+    int rank = 0;
+    for (int frame = 0; frame <= (int)bits.size(); frame++) {
+        CHECK(bitset.rank(frame) == rank);
+        if (frame < (int)bits.size() && bits[frame])
+            rank++;
+    }
+
+    for (int n = -1; n <= (int)set_frames.size(); n++)
+        CHECK(bitset.select(n) == (n >= 0 && n < (int)set_frames.size() ? set_frames[n] : -1));
+
+    for (int frame = 0; frame < (int)bits.size(); frame++) {
+        int next = -1, previous = -1;
+        for (size_t i = 0; i < set_frames.size(); i++) {
+            if (set_frames[i] >= frame && next == -1)
+                next = set_frames[i];
+            if (set_frames[i] <= frame)
+                previous = set_frames[i];
+        }
+
+        CHECK(bitset.findNext(frame) == next);
+        CHECK(bitset.findPrevious(frame) == previous);
+    }
+}
+
+
+static void testFrameBitsetWordBoundaries() {
+    FrameBitset bitset;
+    std::vector<bool> bits(200, false);
+    bitset.resize(bits.size());
+    checkFrameBitset(bitset, bits);
+
+    // The first and last frame of each 64 bit word.
+    const int frames[] = { 0, 63, 64, 127, 128, 191, 192, 199 };
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+        CHECK(bitset.set(frames[i]));
+        bits[frames[i]] = true;
+        checkFrameBitset(bitset, bits);
+    }
+
+    CHECK(!bitset.set(64));
+    CHECK(bitset.reset(64));
+    CHECK(!bitset.reset(64));
+    bits[64] = false;
+    checkFrameBitset(bitset, bits);
+
+    // Ranges that end on either side of a word boundary.
+    CHECK(bitset.setRange(60, 66, true) == 6);
+    for (int i = 60; i <= 66; i++)
+        bits[i] = true;
+    checkFrameBitset(bitset, bits);
+
+    CHECK(bitset.setRange(63, 128, false) == 6);
+    for (int i = 63; i <= 128; i++)
+        bits[i] = false;
+    checkFrameBitset(bitset, bits);
+
+    int num_cleared = 200 - bitset.count();
+    CHECK(bitset.setRange(0, 199, true) == num_cleared);
+    bits.assign(200, true);
+    checkFrameBitset(bitset, bits);
+
+    // Shrinking in the middle of a word must clear the frames that are cut off,
+    // so they don't come back when it grows again.
+    bitset.resize(130);
+    bits.resize(130);
+    checkFrameBitset(bitset, bits);
+
+    bitset.resize(192);
+    bits.resize(192, false);
+    checkFrameBitset(bitset, bits);
+
+    bitset.resize(128);
+    bits.resize(128);
+    checkFrameBitset(bitset, bits);
+}
+
+
+// One character per frame: the overridden match, or '.' where the original match is used.
+static std::string overridesToString(const MatchOverrides &overrides, int num_frames) {
+    std::string str(num_frames, '.');
+
+    for (int i = 0; i < num_frames; i++) {
+        const MatchRun *run = overrides.find(i);
+        if (run)
+            str[i] = run->get(i);
+    }
+
+    return str;
+}
+
+
+static void testMatchOverrides() {
+    MatchOverrides overrides;
+
+    // Frames before the origin still follow the pattern.
+    overrides.setPattern(5, 9, 7, "pc");
+    CHECK(overridesToString(overrides, 12) == ".....pcpcp..");
+
+    overrides.setPattern(10, 29, 10, "pcn");
+    CHECK(overridesToString(overrides, 32) == ".....pcpcppcnpcnpcnpcnpcnpcnpc..");
+    CHECK(overrides.getRuns().size() == 2);
+
+    // Erasing the middle of a run keeps both ends in phase.
+    overrides.erase(15, 19);
+    CHECK(overridesToString(overrides, 32) == ".....pcpcppcnpc.....cnpcnpcnpc..");
+    CHECK(overrides.getRuns().size() == 3);
+
+    // Across a gap and two runs, and where nothing is overridden.
+    overrides.erase(8, 21);
+    CHECK(overridesToString(overrides, 32) == ".....pcp..............pcnpcnpc..");
+    overrides.erase(0, 4);
+    overrides.erase(30, 100);
+    CHECK(overridesToString(overrides, 32) == ".....pcp..............pcnpcnpc..");
+
+    // Exactly one run.
+    overrides.erase(22, 29);
+    CHECK(overridesToString(overrides, 32) == ".....pcp........................");
+    CHECK(overrides.getRuns().size() == 1);
+
+    overrides.clear();
+
+    // Neighbours merge only when the sequence carries on without a break.
+    overrides.setPattern(0, 4, 0, "pc");
+    overrides.setPattern(5, 9, 5, "pc");
+    CHECK(overrides.getRuns().size() == 2);
+    overrides.setPattern(5, 9, 0, "pc");
+    CHECK(overrides.getRuns().size() == 1);
+    overrides.setPattern(11, 13, 0, "pc");
+    CHECK(overrides.getRuns().size() == 2);
+    overrides.setPattern(10, 10, 0, "pc");
+    CHECK(overrides.getRuns().size() == 1);
+    CHECK(overridesToString(overrides, 16) == "pcpcpcpcpcpcpc..");
+
+    // The same sequence written as another pattern, over part of a run or after it, leaves one run.
+    overrides.setPattern(3, 6, 1, "cp");
+    CHECK(overrides.getRuns().size() == 1);
+    overrides.setPattern(14, 15, 14, "pcpc");
+    CHECK(overrides.getRuns().size() == 1);
+    CHECK(overridesToString(overrides, 18) == "pcpcpcpcpcpcpcpc..");
+
+    // A different pattern in the middle splits the run in three.
+    overrides.setPattern(4, 5, 4, "n");
+    CHECK(overrides.getRuns().size() == 3);
+    CHECK(overridesToString(overrides, 18) == "pcpcnnpcpcpcpcpc..");
+
+    // An invalid pattern, or an empty range, changes nothing.
+    const char *invalid_patterns[] = { "", "pcnbup", "pcx" };
+    for (size_t i = 0; i < sizeof(invalid_patterns) / sizeof(invalid_patterns[0]); i++) {
+        bool thrown = false;
+        try {
+            overrides.setPattern(0, 15, 0, invalid_patterns[i]);
+        } catch (WobblyException &) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+    overrides.setPattern(8, 7, 0, "b");
+    CHECK(overrides.getRuns().size() == 3);
+    CHECK(overridesToString(overrides, 18) == "pcpcnnpcpcpcpcpc..");
+
+    overrides.clear();
+
+    // Single frames merge, and setting the original match splits them again.
+    overrides.set(20, 'b', 'c');
+    overrides.set(22, 'b', 'c');
+    overrides.set(21, 'b', 'c');
+    CHECK(overrides.getRuns().size() == 1);
+    overrides.set(21, 'c', 'c');
+    CHECK(overrides.getRuns().size() == 2);
+    overrides.set(23, 'c', 'c');
+    CHECK(overridesToString(overrides, 24) == "....................b.b.");
+
+    std::vector<MatchRun> range;
+    overrides.getRange(21, 30, range);
+    CHECK(range.size() == 1 && range[0].first == 22 && range[0].last == 22);
+
+    std::string matches = "xxcccccccccccccccccccccccc";
+    overrides.apply(matches, 2);
+    CHECK(matches == "xxccccccccccccccccccccbcbc");
+}
+
+
+// A crash in the middle of writing a record leaves part of it at the end of the journal.
+static void testJournalReplayAfterTruncation() {
+    const std::string baseline_path = "wobbly-tests-baseline.json";
+    const std::string path = "wobbly-tests-journal.json";
+
+    writeFile(baseline_path, baseline_project);
+
+    {
+        WobblyProject project(true);
+        project.readProject(baseline_path);
+        project.setJournalEnabled(true);
+        project.writeProject(path);
+
+        project.setMatch(1, 'n');
+        project.addCombedFrame(5);
+        project.addFreezeFrame(0, 0, 1);
+    }
+
+    // Cut the last record in half.
+    std::string journal = readFile(path + ".journal");
+    size_t last_record = journal.rfind('\n', journal.size() - 2) + 1;
+    writeFile(path + ".journal", journal.substr(0, last_record + (journal.size() - last_record) / 2));
+
+    {
+        WobblyProject project(true);
+        project.readProject(path);
+        CHECK(project.getRecoveredJournalRecords() == 2);
+        CHECK(project.getMatch(1) == 'n');
+        CHECK(project.isCombedFrame(5));
+        CHECK(!project.findFreezeFrame(0));
+
+        // The next record must not be glued to what was left of the cut one.
+        project.setMatch(2, 'b');
+    }
+
+    CHECK(readFile(path + ".journal").compare(0, last_record, journal, 0, last_record) == 0);
+
+    WobblyProject project(true);
+    project.readProject(path);
+    CHECK(project.getRecoveredJournalRecords() == 3);
+    CHECK(project.getMatch(1) == 'n' && project.getMatch(2) == 'b');
+    CHECK(project.isCombedFrame(5));
+    CHECK(!project.findFreezeFrame(0));
+
+    removeProject(baseline_path);
+    removeProject(path);
+}
+
+
+int main() {
+    struct Test {
+        const char *name;
+        std::function<void ()> function;
+    };
+
+    const Test tests[] = {
+        { "project round trip", testProjectRoundTrip },
+        { "journal replay after truncation", testJournalReplayAfterTruncation },
+        { "FenwickTree search", testFenwickTreeSearch },
+        { "FrameBitset rank and select at word boundaries", testFrameBitsetWordBoundaries },
+        { "MatchOverrides", testMatchOverrides },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int failures_before = num_failures;
+
+        try {
+            tests[i].function();
+        } catch (WobblyException &e) {
+            fprintf(stderr, "%s: %s\n", tests[i].name, e.what());
+            num_failures++;
+        }
+
+        printf("%s: %s\n", tests[i].name, num_failures == failures_before ? "ok" : "FAILED");
+    }
+
+    return num_failures ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+#include <QDir>
+#include <QFileInfo>
+
+#include "MainDisplayGraph.h"
+#include "WobblyException.h"
+
+
+MainDisplayGraph::MainDisplayGraph(const VSAPI *_vsapi, VSCore *_core)
+    : vsapi(_vsapi)
+    , core(_core)
+    , source(nullptr)
+    , trimmed(nullptr)
+{
+
+}
+
+
+MainDisplayGraph::~MainDisplayGraph() {
+    reset();
+}
+
+
+void MainDisplayGraph::reset() {
+    vsapi->freeNode(trimmed);
+    trimmed = nullptr;
+
+    vsapi->freeNode(source);
+    source = nullptr;
+}
+
+
+VSNodeRef *MainDisplayGraph::invoke(const char *plugin_id, const char *function, VSMap *args) {
+    VSPlugin *plugin = vsapi->getPluginById(plugin_id, core);
+    if (!plugin) {
+        vsapi->freeMap(args);
+        throw WobblyException(std::string("Can't build the main display: plugin '") + plugin_id + "' not found.");
+    }
+
+    VSMap *result = vsapi->invoke(plugin, function, args);
+    vsapi->freeMap(args);
+
+    const char *error = vsapi->getError(result);
+    if (error) {
+        std::string message = error;
+        vsapi->freeMap(result);
+        throw WobblyException(std::string("Can't build the main display: ") + function + " failed. Error message: " + message);
+    }
+
+    VSNodeRef *node = vsapi->propGetNode(result, "clip", 0, nullptr);
+    vsapi->freeMap(result);
+
+    return node;
+}
+
+
+VSNodeRef *MainDisplayGraph::filter(VSNodeRef *clip, const char *plugin_id, const char *function, VSMap *args) {
+    if (!args)
+        args = vsapi->createMap();
+
+    // The map keeps its own reference.
+    vsapi->propSetNode(args, "clip", clip, paReplace);
+    vsapi->freeNode(clip);
+
+    return invoke(plugin_id, function, args);
+}
+
+
+VSNodeRef *MainDisplayGraph::getSource(WobblyProject *project) {
+    if (!source) {
+        // Relative to the project, like in the scripts, which run in the project's folder.
+        QString input_file = QFileInfo(QString::fromStdString(project->project_path)).dir().absoluteFilePath(QString::fromStdString(project->input_file));
+        QByteArray input = input_file.toUtf8();
+
+        VSMap *args = vsapi->createMap();
+        vsapi->propSetData(args, "input", input.constData(), input.size(), paReplace);
+
+        source = invoke("com.sources.d2vsource", "Source", args);
+    }
+
+    return vsapi->cloneNodeRef(source);
+}
+
+
+VSNodeRef *MainDisplayGraph::buildTrimmed(WobblyProject *project) {
+    VSNodeRef *src = getSource(project);
+
+    if (project->trims.empty())
+        return src;
+
+    VSMap *args = vsapi->createMap();
+
+    for (auto it = project->trims.cbegin(); it != project->trims.cend(); it++) {
+        VSMap *trim_args = vsapi->createMap();
+        vsapi->propSetNode(trim_args, "clip", src, paReplace);
+        vsapi->propSetInt(trim_args, "first", it->second.first, paReplace);
+        vsapi->propSetInt(trim_args, "last", it->second.last, paReplace);
+
+        VSNodeRef *trim = nullptr;
+        try {
+            trim = invoke("com.vapoursynth.std", "Trim", trim_args);
+        } catch (WobblyException &) {
+            vsapi->freeMap(args);
+            vsapi->freeNode(src);
+            throw;
+        }
+
+        vsapi->propSetNode(args, "clips", trim, paAppend);
+        vsapi->freeNode(trim);
+    }
+
+    vsapi->freeNode(src);
+
+    return invoke("com.vapoursynth.std", "Splice", args);
+}
+
+
+VSNodeRef *MainDisplayGraph::buildBranch(WobblyProject *project, bool show_crop, char match) {
+    int num_frames = vsapi->getVideoInfo(trimmed)->numFrames;
+
+    // The first and last frames can't use the previous or next frame's fields.
+    std::string matches(num_frames, match);
+    if (num_frames && (match == 'p' || match == 'b'))
+        matches.front() = 'c';
+    if (num_frames && (match == 'n' || match == 'u'))
+        matches.back() = 'c';
+
+    VSMap *args = vsapi->createMap();
+    vsapi->propSetInt(args, "tff", (int)project->vfm_parameters["order"], paReplace);
+    vsapi->propSetData(args, "matches", matches.c_str(), (int)matches.size(), paReplace);
+
+    VSNodeRef *clip = filter(vsapi->cloneNodeRef(trimmed), "com.nodame.fieldhint", "FieldHint", args);
+
+    if (show_crop && project->isCropEnabled()) {
+        const char *sides[4] = { "left", "top", "right", "bottom" };
+        int values[4] = { project->crop.left, project->crop.top, project->crop.right, project->crop.bottom };
+
+        args = vsapi->createMap();
+        for (int i = 0; i < 4; i++)
+            vsapi->propSetInt(args, sides[i], values[i], paReplace);
+
+        clip = filter(clip, "com.vapoursynth.std", "CropRel", args);
+
+        args = vsapi->createMap();
+        for (int i = 0; i < 4; i++)
+            vsapi->propSetInt(args, sides[i], values[i], paReplace);
+        vsapi->propSetFloat(args, "color", 128, paAppend);
+        vsapi->propSetFloat(args, "color", 230, paAppend);
+        vsapi->propSetFloat(args, "color", 180, paAppend);
+
+        clip = filter(clip, "com.vapoursynth.std", "AddBorders", args);
+    }
+
+    clip = filter(clip, "com.vapoursynth.std", "FlipVertical");
+
+    args = vsapi->createMap();
+    vsapi->propSetInt(args, "format", pfCompatBGR32, paReplace);
+
+    return filter(clip, "com.vapoursynth.resize", "Bicubic", args);
+}
+
+
+VSNodeRef *MainDisplayGraph::build(WobblyProject *project, bool show_crop, MatchSelector &selector) {
+    if (!trimmed)
+        trimmed = buildTrimmed(project);
+
+    VSNodeRef *branches[5] = { nullptr };
+
+    try {
+        for (int i = 0; i < 5; i++)
+            branches[i] = buildBranch(project, show_crop, "pcnbu"[i]);
+
+        VSNodeRef *node = selector.createNode(branches, core, vsapi);
+
+        for (int i = 0; i < 5; i++)
+            vsapi->freeNode(branches[i]);
+
+        return node;
+    } catch (WobblyException &) {
+        for (int i = 0; i < 5; i++)
+            vsapi->freeNode(branches[i]);
+
+        throw;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef MAINDISPLAYGRAPH_H
+#define MAINDISPLAYGRAPH_H
+
+
+#include <string>
+
+#include <VapourSynth.h>
+
+#include "MatchSelector.h"
+#include "WobblyProject.h"
+
+
+// Builds the main display with the VapourSynth API instead of a Python script:
+// source, trims, FieldHint once per match, crop, RGB conversion, and the match selector.
+class MainDisplayGraph {
+public:
+    MainDisplayGraph(const VSAPI *_vsapi, VSCore *_core);
+    ~MainDisplayGraph();
+
+    // Forgets the source. Needed when another project is opened.
+    void reset();
+
+    // Returns a new reference to the last node.
+    VSNodeRef *build(WobblyProject *project, bool show_crop, MatchSelector &selector);
+
+    // Returns a new reference to the source, so the preview can use it instead of opening the file again.
+    VSNodeRef *getSource(WobblyProject *project);
+
+private:
+    const VSAPI *vsapi;
+    VSCore *core;
+    VSNodeRef *source; // The source and the trims never change, so they are built once.
+    VSNodeRef *trimmed;
+
+    VSNodeRef *buildTrimmed(WobblyProject *project);
+    VSNodeRef *buildBranch(WobblyProject *project, bool show_crop, char match);
+
+    VSNodeRef *invoke(const char *plugin_id, const char *function, VSMap *args); // Frees args.
+    VSNodeRef *filter(VSNodeRef *clip, const char *plugin_id, const char *function, VSMap *args = nullptr); // Frees clip and args.
+};
+
+#endif // MAINDISPLAYGRAPH_H
@@ -0,0 +1,156 @@
+#include <string>
+
+#include "MatchSelector.h"
+#include "PackedMatches.h"
+#include "WobblyException.h"
+
+
+struct MatchSelectorData {
+    VSNodeRef *branches[5];
+    VSVideoInfo vi;
+    std::shared_ptr<MatchSelector::Frames> frames;
+};
+
+
+static void VS_CC matchSelectorInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
+    (void)in;
+    (void)out;
+    (void)core;
+
+    MatchSelectorData *d = (MatchSelectorData *)*instanceData;
+
+    vsapi->setVideoInfo(&d->vi, 1, node);
+}
+
+
+static const VSFrameRef *VS_CC matchSelectorGetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    (void)core;
+
+    MatchSelectorData *d = (MatchSelectorData *)*instanceData;
+
+    if (activationReason == arInitial) {
+        int frame, match;
+        d->frames->get(n, frame, match);
+
+        // The match can change before the frame arrives, so remember which one was requested.
+        *frameData = (void *)((intptr_t)frame * 5 + match);
+
+        vsapi->requestFrameFilter(frame, d->branches[match], frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        intptr_t request = (intptr_t)*frameData;
+
+        return vsapi->getFrameFilter((int)(request / 5), d->branches[request % 5], frameCtx);
+    }
+
+    return nullptr;
+}
+
+
+static void VS_CC matchSelectorFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    (void)core;
+
+    MatchSelectorData *d = (MatchSelectorData *)instanceData;
+
+    for (int i = 0; i < 5; i++)
+        vsapi->freeNode(d->branches[i]);
+
+    delete d;
+}
+
+
+MatchSelector::MatchSelector()
+    : frames(new Frames)
+{
+
+}
+
+
+void MatchSelector::Frames::get(int n, int &frame, int &match) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    frame = replacements[n];
+    match = matches[frame];
+}
+
+
+void MatchSelector::reset(WobblyProject *project) {
+    int num_frames = project->num_frames[PostSource];
+
+    std::lock_guard<std::mutex> guard(frames->lock);
+
+    frames->matches.resize(num_frames);
+    frames->replacements.resize(num_frames);
+
+    for (int i = 0; i < num_frames; i++) {
+        frames->matches[i] = matchCharToIndex(project->getMatch(i));
+        frames->replacements[i] = i;
+    }
+
+    for (auto it = project->frozen_frames.cbegin(); it != project->frozen_frames.cend(); it++)
+        for (int i = it->second.first; i <= it->second.last; i++)
+            frames->replacements[i] = it->second.replacement;
+}
+
+
+void MatchSelector::update(WobblyProject *project, ChangeType type, int first, int last) {
+    if (type != ChangeMatches && type != ChangeFreezeFrames)
+        return;
+
+    std::lock_guard<std::mutex> guard(frames->lock);
+
+    for (int i = first; i <= last; i++) {
+        if (type == ChangeMatches) {
+            frames->matches[i] = matchCharToIndex(project->getMatch(i));
+        } else {
+            const FreezeFrame *ff = project->findFreezeFrame(i);
+            frames->replacements[i] = ff ? ff->replacement : i;
+        }
+    }
+}
+
+
+VSNodeRef *MatchSelector::createNode(VSNodeRef *const branches[5], VSCore *core, const VSAPI *vsapi) {
+    const VSVideoInfo *vi = vsapi->getVideoInfo(branches[0]);
+
+    for (int i = 1; i < 5; i++) {
+        const VSVideoInfo *other = vsapi->getVideoInfo(branches[i]);
+
+        if (other->format != vi->format || other->width != vi->width || other->height != vi->height || other->numFrames != vi->numFrames)
+            throw WobblyException("Can't create the match selector: the clips for the five matches are different.");
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(frames->lock);
+
+        if (vi->numFrames != (int)frames->matches.size())
+            throw WobblyException("Can't create the match selector: the clip has " + std::to_string(vi->numFrames) + " frames, but the project has " + std::to_string(frames->matches.size()) + ".");
+    }
+
+    MatchSelectorData *d = new MatchSelectorData;
+    for (int i = 0; i < 5; i++)
+        d->branches[i] = vsapi->cloneNodeRef(branches[i]);
+    d->vi = *vi;
+    d->frames = frames;
+
+    VSMap *in = vsapi->createMap();
+    VSMap *out = vsapi->createMap();
+
+    vsapi->createFilter(in, out, "WobblyMatchSelector", matchSelectorInit, matchSelectorGetFrame, matchSelectorFree, fmParallel, nfNoCache, d, core);
+
+    const char *error = vsapi->getError(out);
+    if (error) {
+        std::string message = error;
+
+        vsapi->freeMap(in);
+        vsapi->freeMap(out);
+
+        throw WobblyException("Can't create the match selector. Error message: " + message);
+    }
+
+    VSNodeRef *node = vsapi->propGetNode(out, "clip", 0, nullptr);
+
+    vsapi->freeMap(in);
+    vsapi->freeMap(out);
+
+    return node;
+}
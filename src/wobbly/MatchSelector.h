@@ -0,0 +1,46 @@
+#ifndef MATCHSELECTOR_H
+#define MATCHSELECTOR_H
+
+
+#include <cstdint>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <VapourSynth.h>
+
+#include "WobblyProject.h"
+
+
+// Shows every frame with its current match and freeze frame. The inputs are the same clip
+// field matched five times, once with each match, so a match or freeze frame edit only means
+// taking the frame from another input. No script is evaluated again, and the inputs keep
+// their frame caches. The filter itself doesn't cache anything.
+class MatchSelector {
+public:
+    MatchSelector();
+
+    // Copies the matches and freeze frames of every frame.
+    void reset(WobblyProject *project);
+
+    // Called from the project's change listener.
+    void update(WobblyProject *project, ChangeType type, int first, int last);
+
+    // branches are the five inputs, in the order p, c, n, b, u. The node takes its own references.
+    VSNodeRef *createNode(VSNodeRef *const branches[5], VSCore *core, const VSAPI *vsapi);
+
+    // The frame and the input that frame n comes from. Called from VapourSynth's threads.
+    struct Frames {
+        std::mutex lock;
+        std::vector<uint8_t> matches; // Indices of p, c, n, b, u.
+        std::vector<int> replacements; // The frame itself, unless it's frozen.
+
+        void get(int n, int &frame, int &match);
+    };
+
+private:
+    std::shared_ptr<Frames> frames; // Shared with the nodes.
+};
+
+#endif // MATCHSELECTOR_H
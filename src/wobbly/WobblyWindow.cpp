@@ -1,6 +1,9 @@
 #include <QComboBox>
 #include <QDockWidget>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QInputDialog>
 #include <QMenuBar>
 #include <QMessageBox>
@@ -9,6 +12,7 @@
 #include <QShortcut>
 #include <QSpinBox>
 #include <QStatusBar>
+#include <QtConcurrent>
 
 #include <QHBoxLayout>
 #include <QVBoxLayout>
@@ -25,11 +29,14 @@ WobblyWindow::WobblyWindow()
     , match_pattern("ccnnc")
     , decimation_pattern("kkkkd")
     , preview(false)
+    , autosave_needed(false)
     , vsapi(nullptr)
     , vsscript(nullptr)
     , vscore(nullptr)
+    , main_display_graph(nullptr)
     , vsnode{nullptr, nullptr}
     , vsframe(nullptr)
+    , main_display_dirty(true)
 {
     createUI();
 
@@ -59,13 +66,25 @@ void WobblyWindow::closeEvent(QCloseEvent *event) {
         if (answer == QMessageBox::Yes) {
             saveProject();
         } else if (answer == QMessageBox::No) {
-            ;
+            // Forget the changes made since the last save, but keep those saved in the journal.
+            try {
+                project->rollbackJournal();
+            } catch (WobblyException &e) {
+                errorPopup(e.what());
+            }
+
+            // Nor should the next open offer to recover them from the autosave.
+            autosave_watcher.waitForFinished();
+            removeAutosave(QString::fromStdString(project->project_path));
         } else {
             event->ignore();
             return;
         }
     }
 
+    autosave_timer->stop();
+    autosave_watcher.waitForFinished();
+
     cleanUpVapourSynth();
 
     if (project) {
@@ -85,8 +104,14 @@ void WobblyWindow::createMenu() {
     QAction *projectOpen = new QAction("&Open project", this);
     QAction *projectSave = new QAction("&Save project", this);
     QAction *projectSaveAs = new QAction("&Save project as", this);
+    QAction *projectExportTimecodes = new QAction("Export &timecodes", this);
+    frame_data_file_action = new QAction("Store frame data in a separate &file", this);
+    journal_action = new QAction("Save only the &changes (journal)", this);
     QAction *projectQuit = new QAction("&Quit", this);
 
+    frame_data_file_action->setCheckable(true);
+    journal_action->setCheckable(true);
+
     projectOpen->setShortcut(QKeySequence::Open);
     projectSave->setShortcut(QKeySequence::Save);
     projectSaveAs->setShortcut(QKeySequence::SaveAs);
@@ -95,15 +120,37 @@ void WobblyWindow::createMenu() {
     connect(projectOpen, &QAction::triggered, this, &WobblyWindow::openProject);
     connect(projectSave, &QAction::triggered, this, &WobblyWindow::saveProject);
     connect(projectSaveAs, &QAction::triggered, this, &WobblyWindow::saveProjectAs);
+    connect(projectExportTimecodes, &QAction::triggered, this, &WobblyWindow::exportTimecodes);
+    connect(frame_data_file_action, &QAction::triggered, this, &WobblyWindow::frameDataFileToggled);
+    connect(journal_action, &QAction::triggered, this, &WobblyWindow::journalToggled);
     connect(projectQuit, &QAction::triggered, this, &QWidget::close);
 
     p->addAction(projectOpen);
     p->addAction(projectSave);
     p->addAction(projectSaveAs);
+    p->addAction(projectExportTimecodes);
+    p->addSeparator();
+    p->addAction(frame_data_file_action);
+    p->addAction(journal_action);
     p->addSeparator();
     p->addAction(projectQuit);
 
 
+    QMenu *e = bar->addMenu("&Edit");
+
+    QAction *editUndo = new QAction("&Undo", this);
+    QAction *editRedo = new QAction("&Redo", this);
+
+    editUndo->setShortcut(QKeySequence::Undo);
+    editRedo->setShortcut(QKeySequence::Redo);
+
+    connect(editUndo, &QAction::triggered, this, &WobblyWindow::undo);
+    connect(editRedo, &QAction::triggered, this, &WobblyWindow::redo);
+
+    e->addAction(editUndo);
+    e->addAction(editRedo);
+
+
     tools_menu = bar->addMenu("&Tools");
 }
 
@@ -128,6 +175,9 @@ void WobblyWindow::createShortcuts() {
         { "PgUp", &WobblyWindow::jumpALotForward },
         { "Ctrl+Up", &WobblyWindow::jumpToNextSectionStart },
         { "Ctrl+Down", &WobblyWindow::jumpToPreviousSectionStart },
+        { "Shift+Up", &WobblyWindow::jumpToNextCombedFrame },
+        { "Shift+Down", &WobblyWindow::jumpToPreviousCombedFrame },
+        { "Ctrl+G", &WobblyWindow::jumpToOutputFrame },
         { "S", &WobblyWindow::cycleMatchPCN },
         { "Ctrl+F", &WobblyWindow::freezeForward },
         { "Shift+F", &WobblyWindow::freezeBackward },
@@ -266,7 +316,7 @@ void WobblyWindow::createCropAssistant() {
             return;
 
         try {
-            evaluateMainDisplayScript();
+            buildMainDisplay();
         } catch (WobblyException &) {
 
         }
@@ -351,6 +401,16 @@ void WobblyWindow::createPatternEditor() {
 }
 
 
+void WobblyWindow::createAutosave() {
+    autosave_timer = new QTimer(this);
+    autosave_timer->setInterval(2 * 60 * 1000);
+    connect(autosave_timer, &QTimer::timeout, this, &WobblyWindow::autosave);
+    autosave_timer->start();
+
+    connect(&autosave_watcher, &QFutureWatcher<QString>::finished, this, &WobblyWindow::autosaveFinished);
+}
+
+
 void WobblyWindow::createUI() {
     createMenu();
     createShortcuts();
@@ -376,6 +436,7 @@ void WobblyWindow::createUI() {
     createCropAssistant();
     createPresetEditor();
     createPatternEditor();
+    createAutosave();
 }
 
 
@@ -394,6 +455,8 @@ void WobblyWindow::initialiseVapourSynth() {
     vscore = vsscript_getCore(vsscript);
     if (!vscore)
         throw WobblyException("Fatal error: failed to retrieve VapourSynth core object.");
+
+    main_display_graph = new MainDisplayGraph(vsapi, vscore);
 }
 
 
@@ -407,6 +470,9 @@ void WobblyWindow::cleanUpVapourSynth() {
         vsnode[i] = nullptr;
     }
 
+    delete main_display_graph;
+    main_display_graph = nullptr;
+
     vsscript_freeScript(vsscript);
     vsscript = nullptr;
 }
@@ -438,6 +504,12 @@ void WobblyWindow::checkRequiredFilters() {
             "VapourSynth standard filter library not found. This should never happen.",
             "VapourSynth version is too old."
         },
+        {
+            "com.vapoursynth.resize",
+            "Bicubic",
+            "VapourSynth resize plugin not found. This should never happen.",
+            "VapourSynth version is too old."
+        },
         {
             "the.weather.channel",
             "Colorspace",
@@ -502,13 +574,25 @@ void WobblyWindow::initialiseUIFromProject() {
     resize_box->setChecked(project->isResizeEnabled());
 
 
+    // Frame data file.
+    frame_data_file_action->setChecked(project->isFrameDataFileEnabled());
+    journal_action->setChecked(project->isJournalEnabled());
+
+
     // Presets.
+    QString current_preset = preset_combo->currentText();
+
+    preset_combo->clear();
+
     for (auto it = project->presets.cbegin(); it != project->presets.cend(); it++)
         preset_combo->addItem(QString::fromStdString(it->second.name));
 
     if (preset_combo->count()) {
-        preset_combo->setCurrentIndex(0);
+        int index = preset_combo->findText(current_preset);
+        preset_combo->setCurrentIndex(index != -1 ? index : 0);
         presetChanged(preset_combo->currentText());
+    } else {
+        presetChanged(QString());
     }
 }
 
@@ -520,7 +604,21 @@ void WobblyWindow::openProject() {
         WobblyProject *tmp = new WobblyProject(true);
 
         try {
-            tmp->readProject(path.toStdString());
+            // An autosave newer than the project means Wobbly didn't get to save the latest changes.
+            bool recover = false;
+            QFileInfo autosave_info(path + ".autosave");
+
+            if (autosave_info.exists() && autosave_info.lastModified() > QFileInfo(path).lastModified()) {
+                QMessageBox::StandardButton answer = QMessageBox::question(this, QStringLiteral("Recover autosave?"), QStringLiteral("This project has an autosave newer than the project file. It contains changes that were never saved.\n\nOpen the autosave instead?"), QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
+
+                recover = answer == QMessageBox::Yes;
+            }
+
+            // Saving the recovered project replaces the project file, not the autosave.
+            if (recover)
+                tmp->recoverAutosave(path.toStdString());
+            else
+                tmp->readProject(path.toStdString());
 
             project_path = path;
 
@@ -528,11 +626,20 @@ void WobblyWindow::openProject() {
                 delete project;
             project = tmp;
 
+            project->addChangeListener([this] (ChangeType type, int first, int last) {
+                projectChanged(type, first, last);
+            });
+            match_selector.reset(project);
+            main_display_graph->reset();
+
             initialiseUIFromProject();
 
-            vsscript_clearOutput(vsscript, 1);
+            if (project->getRecoveredJournalRecords())
+                QMessageBox::information(this, QStringLiteral("Recovered changes"), QStringLiteral("Recovered %1 changes that were not saved before Wobbly was closed.").arg(project->getRecoveredJournalRecords()));
+
+            buildMainDisplay();
 
-            evaluateMainDisplayScript();
+            shareSourceWithPreview();
         } catch (WobblyException &e) {
             errorPopup(e.what());
 
@@ -552,9 +659,16 @@ void WobblyWindow::realSaveProject(const QString &path) {
     if (preset_combo->currentIndex() != -1)
         project->setPresetContents(preset_combo->currentText().toStdString(), preset_edit->toPlainText().toStdString());
 
-    project->writeProject(path.toStdString());
+    // A running autosave may still be reading the metrics from the project file.
+    autosave_watcher.waitForFinished();
+
+    project->saveProject(path.toStdString());
 
     project_path = path;
+
+    // The project file has everything the autosave has.
+    removeAutosave(path);
+    autosave_needed = false;
 }
 
 
@@ -588,29 +702,145 @@ void WobblyWindow::saveProjectAs() {
 }
 
 
-void WobblyWindow::evaluateMainDisplayScript() {
-    std::string script = project->generateMainDisplayScript(crop_dock->isVisible());
+void WobblyWindow::exportTimecodes() {
+    try {
+        if (!project)
+            throw WobblyException("Can't export the timecodes because no project has been loaded.");
 
-    if (vsscript_evaluateScript(&vsscript, script.c_str(), QFileInfo(project->project_path.c_str()).dir().path().toUtf8().constData(), efSetWorkingDir)) {
-        std::string error = vsscript_getError(vsscript);
-        // The traceback is mostly unnecessary noise.
-        size_t traceback = error.find("Traceback");
-        if (traceback != std::string::npos)
-            error.erase(traceback);
+        QString path = QFileDialog::getSaveFileName(this, QStringLiteral("Export timecodes"), QString(), QStringLiteral("Timecodes (*.txt)"), nullptr, QFileDialog::DontUseNativeDialog);
 
-        throw WobblyException("Failed to evaluate main display script. Error message:\n" + error);
+        if (!path.isNull())
+            project->writeTimecodes(path.toStdString());
+    } catch (WobblyException &e) {
+        errorPopup(e.what());
     }
+}
+
+
+void WobblyWindow::autosave() {
+    if (!project)
+        return;
+
+    // The previous autosave is taking longer than the interval. Skip this one.
+    if (autosave_watcher.isRunning())
+        return;
+
+    // Nothing changed since the last save or autosave.
+    if (!autosave_needed)
+        return;
+
+    autosave_needed = false;
+
+    // Only the snapshot is taken in the GUI thread. It's all the GUI has to wait for.
+    QElapsedTimer timer;
+    timer.start();
+
+    std::shared_ptr<WobblyProject> snapshot(project->createSnapshot());
+
+    double snapshot_msecs = timer.nsecsElapsed() / 1000000.0;
+
+    std::string path = project->project_path + ".autosave";
+
+    autosave_watcher.setFuture(QtConcurrent::run([snapshot, path, snapshot_msecs] () mutable -> QString {
+        QElapsedTimer write_timer;
+        write_timer.start();
+
+        // Released as soon as it's written. Until then, the project copies any per-frame data it changes.
+        try {
+            snapshot->writeProject(path);
+            snapshot.reset();
+        } catch (WobblyException &e) {
+            snapshot.reset();
+            return QStringLiteral("Autosave failed: %1").arg(e.what());
+        }
+
+        return QStringLiteral("Autosaved to %1. Snapshot: %2 ms (GUI thread), writing: %3 ms (background).")
+                .arg(QString::fromStdString(path))
+                .arg(snapshot_msecs, 0, 'f', 2)
+                .arg(write_timer.elapsed());
+    }));
+}
+
+
+void WobblyWindow::removeAutosave(const QString &path) {
+    QFile::remove(path + ".autosave");
+    QFile::remove(path + ".autosave.frames");
+}
+
+
+void WobblyWindow::autosaveFinished() {
+    statusBar()->showMessage(autosave_watcher.result(), 10000);
+}
+
+
+void WobblyWindow::frameDataFileToggled(bool checked) {
+    if (!project)
+        return;
+
+    project->setFrameDataFileEnabled(checked);
+}
+
+
+void WobblyWindow::journalToggled(bool checked) {
+    if (!project)
+        return;
+
+    project->setJournalEnabled(checked);
+}
+
+
+void WobblyWindow::buildMainDisplay() {
+    VSNodeRef *node = main_display_graph->build(project, crop_dock->isVisible(), match_selector);
 
     vsapi->freeNode(vsnode[0]);
 
-    vsnode[0] = vsscript_getOutput(vsscript, 0);
-    if (!vsnode[0])
-        throw WobblyException("Main display script evaluated successfully, but no node found at output index 0.");
+    vsnode[0] = node;
+
+    main_display_dirty = false;
 
     displayFrame(current_frame);
 }
 
 
+void WobblyWindow::shareSourceWithPreview() {
+    // Never let the preview use the previous project's source.
+    vsscript_clearOutput(vsscript, 1);
+
+    // The final script takes the source from output index 1 if it's there, so the preview doesn't open the file a second time.
+    VSMap *vars = vsapi->createMap();
+    VSNodeRef *source = main_display_graph->getSource(project);
+    vsapi->propSetNode(vars, "wobbly_source", source, paReplace);
+    vsapi->freeNode(source);
+
+    int failed = vsscript_setVariable(vsscript, vars);
+    vsapi->freeMap(vars);
+    if (failed)
+        throw WobblyException("Failed to pass the source to the preview's script.");
+
+    if (vsscript_evaluateScript(&vsscript, "wobbly_source.set_output(index=1)\ndel wobbly_source\n", "wobbly_source", 0))
+        throw WobblyException(std::string("Failed to pass the source to the preview's script. Error message: ") + vsscript_getError(vsscript));
+}
+
+
+void WobblyWindow::updateMainDisplay() {
+    if (main_display_dirty || !vsnode[0])
+        buildMainDisplay();
+    else
+        displayFrame(current_frame);
+}
+
+
+void WobblyWindow::projectChanged(ChangeType type, int first, int last) {
+    autosave_needed = true;
+
+    // The match selector reads the matches and freeze frames itself. Of the rest, only the crop is in the main display.
+    if (type == ChangeMatches || type == ChangeFreezeFrames)
+        match_selector.update(project, type, first, last);
+    else if (type == ChangeCropResize)
+        main_display_dirty = true;
+}
+
+
 void WobblyWindow::evaluateFinalScript() {
     std::string script = project->generateFinalScript(true);
 
@@ -696,7 +926,7 @@ void WobblyWindow::updateFrameDetails() {
 
     QString matches("Matches: ");
     for (int i = matches_start; i <= matches_end; i++) {
-        char match = project->matches[i];
+        char match = project->getMatch(i);
 
         bool is_decimated = project->isDecimatedFrame(i);
 
@@ -725,16 +955,16 @@ void WobblyWindow::updateFrameDetails() {
         combed_label->clear();
 
 
-    decimate_metric_label->setText(QStringLiteral("DMetric: ") + QString::number(project->decimate_metrics[current_frame]));
+    decimate_metric_label->setText(QStringLiteral("DMetric: ") + QString::number(project->getDecimateMetric(current_frame)));
 
 
-    int match_index = matchCharToIndex(project->matches[current_frame]);
+    int match_index = matchCharToIndex(project->getMatch(current_frame));
     QString mics("Mics: ");
     for (int i = 0; i < 5; i++) {
         if (i == match_index)
             mics += "<b>";
 
-        mics += QStringLiteral("%1 ").arg((int)project->mics[current_frame][i]);
+        mics += QStringLiteral("%1 ").arg((int)project->getMic(current_frame, i));
 
         if (i == match_index)
             mics += "</b>";
@@ -748,19 +978,22 @@ void WobblyWindow::updateFrameDetails() {
 
     QString presets;
     for (auto it = current_section->presets.cbegin(); it != current_section->presets.cend(); it++)
-        presets.append(QString::fromStdString(*it));
+        presets.append(QString::fromStdString(project->getPresetName(*it)));
 
     if (presets.isNull())
         presets = "<none>";
 
-    section_label->setText(QStringLiteral("Section: [%1,%2]\nPresets:\n%3").arg(section_start).arg(section_end).arg(presets));
+    section_label->setText(QStringLiteral("Section: [%1,%2]\nCombed frames: %3\nPresets:\n%4").arg(section_start).arg(section_end).arg(project->getNumCombedFrames(section_start, section_end)).arg(presets));
+
 
+    std::vector<Interval> annotations;
+    project->findAnnotations(current_frame, current_frame, annotations);
 
     QString custom_lists;
-    for (auto it = project->custom_lists.cbegin(); it != project->custom_lists.cend(); it++) {
-        const FrameRange *range = it->findFrameRange(current_frame);
-        if (range)
-            custom_lists += QStringLiteral("%1: [%2,%3]\n").arg(QString::fromStdString(it->name)).arg(range->first).arg(range->last);
+    for (size_t i = 0; i < annotations.size(); i++) {
+        const Interval &range = annotations[i];
+        if (range.type == AnnotationCustomList)
+            custom_lists += QStringLiteral("%1: [%2,%3]\n").arg(QString::fromStdString(project->custom_lists[range.id].name)).arg(range.first).arg(range.last);
     }
 
     if (custom_lists.isNull())
@@ -786,17 +1019,21 @@ void WobblyWindow::jumpRelative(int offset) {
         target = project->num_frames[PostSource] - 1;
 
     if (preview) {
-        int skip = offset < 0 ? -1 : 1;
-
-        while (true) {
-            if (target == 0 || target == project->num_frames[PostSource] - 1)
-                skip = -skip;
+        // Land on a frame that isn't decimated, preferably in the direction of the jump.
+        int surviving;
 
-            if (!project->isDecimatedFrame(target))
-                break;
-
-            target += skip;
+        if (offset < 0) {
+            surviving = project->findPreviousSurvivingFrame(target);
+            if (surviving == -1)
+                surviving = project->findNextSurvivingFrame(target);
+        } else {
+            surviving = project->findNextSurvivingFrame(target);
+            if (surviving == -1)
+                surviving = project->findPreviousSurvivingFrame(target);
         }
+
+        if (surviving != -1)
+            target = surviving;
     }
 
     displayFrame(target);
@@ -892,10 +1129,92 @@ void WobblyWindow::jumpToPreviousSectionStart() {
 }
 
 
+void WobblyWindow::jumpToNextCombedFrame() {
+    if (!project)
+        return;
+
+    int frame = project->findNextCombedFrame(current_frame);
+
+    if (frame != -1)
+        jumpRelative(frame - current_frame);
+}
+
+
+void WobblyWindow::jumpToPreviousCombedFrame() {
+    if (!project)
+        return;
+
+    int frame = project->findPreviousCombedFrame(current_frame);
+
+    if (frame != -1)
+        jumpRelative(frame - current_frame);
+}
+
+
+void WobblyWindow::jumpToOutputFrame() {
+    if (!project)
+        return;
+
+    bool ok;
+    int frame = QInputDialog::getInt(this, QStringLiteral("Jump to output frame"), QStringLiteral("Frame number after decimation:"), project->frameNumberAfterDecimation(current_frame), 0, std::max(0, project->num_frames[PostDecimate] - 1), 1, &ok);
+
+    if (ok)
+        displayFrame(project->frameNumberBeforeDecimation(frame));
+}
+
+
+void WobblyWindow::journalStoppedPopup() {
+    QMessageBox::information(this, QStringLiteral("Journal stopped"), QStringLiteral("The journal can't record this change, because it goes back to before the project was last saved. Until the project is saved again, Wobbly can't recover the unsaved changes after a crash."));
+}
+
+
+void WobblyWindow::undo() {
+    if (!project || !project->canUndo())
+        return;
+
+    bool journal_stopped = project->isJournalStopped();
+
+    try {
+        project->undo();
+    } catch (WobblyException &e) {
+        errorPopup(e.what());
+    }
+
+    if (!journal_stopped && project->isJournalStopped())
+        journalStoppedPopup();
+
+    // Anything could have changed.
+    initialiseUIFromProject();
+
+    updateMainDisplay();
+}
+
+
+void WobblyWindow::redo() {
+    if (!project || !project->canRedo())
+        return;
+
+    bool journal_stopped = project->isJournalStopped();
+
+    try {
+        project->redo();
+    } catch (WobblyException &e) {
+        errorPopup(e.what());
+    }
+
+    if (!journal_stopped && project->isJournalStopped())
+        journalStoppedPopup();
+
+    initialiseUIFromProject();
+
+    updateMainDisplay();
+}
+
+
 void WobblyWindow::cycleMatchPCN() {
     // N -> C -> P. This is the order Yatta uses, so we use it.
 
-    char &match = project->matches[current_frame];
+    char match = project->getMatch(current_frame);
 
     if (match == 'n')
         match = 'c';
@@ -911,7 +1230,9 @@ void WobblyWindow::cycleMatchPCN() {
             match = 'n';
     }
 
-    evaluateMainDisplayScript();
+    project->setMatch(current_frame, match);
+
+    updateMainDisplay();
 }
 
 
@@ -922,7 +1243,7 @@ void WobblyWindow::freezeForward() {
     try {
         project->addFreezeFrame(current_frame, current_frame, current_frame + 1);
 
-        evaluateMainDisplayScript();
+        updateMainDisplay();
     } catch (WobblyException &) {
         // XXX Maybe don't be silent.
     }
@@ -936,7 +1257,7 @@ void WobblyWindow::freezeBackward() {
     try {
         project->addFreezeFrame(current_frame, current_frame, current_frame - 1);
 
-        evaluateMainDisplayScript();
+        updateMainDisplay();
     } catch (WobblyException &) {
 
     }
@@ -956,7 +1277,7 @@ void WobblyWindow::freezeRange() {
         try {
             project->addFreezeFrame(ff.first, ff.last, ff.replacement);
 
-            evaluateMainDisplayScript();
+            updateMainDisplay();
         } catch (WobblyException &) {
 
         }
@@ -971,7 +1292,7 @@ void WobblyWindow::deleteFreezeFrame() {
     if (ff) {
         project->deleteFreezeFrame(ff->first);
 
-        evaluateMainDisplayScript();
+        updateMainDisplay();
     }
 }
 
@@ -1023,7 +1344,7 @@ void WobblyWindow::cropChanged(int value) {
     project->setCrop(crop_spin[0]->value(), crop_spin[1]->value(), crop_spin[2]->value(), crop_spin[3]->value());
 
     try {
-        evaluateMainDisplayScript();
+        buildMainDisplay();
     } catch (WobblyException &) {
 
     }
@@ -1037,7 +1358,7 @@ void WobblyWindow::cropToggled(bool checked) {
     project->setCropEnabled(checked);
 
     try {
-        evaluateMainDisplayScript();
+        buildMainDisplay();
     } catch (WobblyException &) {
 
     }
@@ -1150,7 +1471,7 @@ void WobblyWindow::resetRange() {
     if (!project)
         return;
 
-    //evaluateMainDisplayScript();
+    //buildMainDisplay();
 }
 
 
@@ -1162,7 +1483,7 @@ void WobblyWindow::resetSection() {
 
     project->resetSectionMatches(section->start);
 
-    evaluateMainDisplayScript();
+    updateMainDisplay();
 }
 
 
@@ -1185,7 +1506,7 @@ void WobblyWindow::rotateAndSetPatterns() {
     project->setSectionMatchesFromPattern(section->start, match_pattern.toStdString());
     project->setSectionDecimationFromPattern(section->start, decimation_pattern.toStdString());
 
-    evaluateMainDisplayScript();
+    updateMainDisplay();
 }
 
 
@@ -1210,5 +1531,5 @@ void WobblyWindow::togglePreview() {
             preview = !preview;
         }
     } else
-        evaluateMainDisplayScript();
+        updateMainDisplay();
 }
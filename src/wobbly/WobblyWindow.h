@@ -4,15 +4,19 @@
 
 #include <QCloseEvent>
 #include <QComboBox>
+#include <QFutureWatcher>
 #include <QGroupBox>
 #include <QLabel>
 #include <QLineEdit>
 #include <QMainWindow>
 #include <QSpinBox>
+#include <QTimer>
 
 #include <VapourSynth.h>
 #include <VSScript.h>
 
+#include "MainDisplayGraph.h"
+#include "MatchSelector.h"
 #include "PresetTextEdit.h"
 #include "WobblyProject.h"
 
@@ -28,6 +32,9 @@ private:
 
     QMenu *tools_menu;
 
+    QAction *frame_data_file_action;
+    QAction *journal_action;
+
 
 
     // Widgets.
@@ -68,15 +75,23 @@ private:
 
     bool preview;
 
+    QTimer *autosave_timer;
+    QFutureWatcher<QString> autosave_watcher;
+    bool autosave_needed; // Something changed since the last save or autosave.
+
 
     // VapourSynth stuff.
 
     const VSAPI *vsapi;
     VSScript *vsscript;
     VSCore *vscore;
+    MainDisplayGraph *main_display_graph;
     VSNodeRef *vsnode[2];
     const VSFrameRef *vsframe;
 
+    MatchSelector match_selector; // Last node of the main display.
+    bool main_display_dirty; // Something besides the matches and freeze frames changed.
+
 
     // Functions
 
@@ -86,6 +101,7 @@ private:
     void createCropAssistant();
     void createPresetEditor();
     void createPatternEditor();
+    void createAutosave();
     void createUI();
 
     void initialiseVapourSynth();
@@ -94,12 +110,16 @@ private:
 
     void initialiseUIFromProject();
 
-    void evaluateMainDisplayScript();
+    void buildMainDisplay();
+    void shareSourceWithPreview();
+    void updateMainDisplay(); // After a change. Builds the main display again only if it must.
+    void projectChanged(ChangeType type, int first, int last);
     void evaluateFinalScript();
     void displayFrame(int n);
     void updateFrameDetails();
 
     void errorPopup(const char *msg);
+    void journalStoppedPopup();
 
     void closeEvent(QCloseEvent *event);
 
@@ -123,6 +143,14 @@ public slots:
     void jumpToNextSectionStart();
     void jumpToPreviousSectionStart();
 
+    void jumpToNextCombedFrame();
+    void jumpToPreviousCombedFrame();
+
+    void jumpToOutputFrame();
+
+    void undo();
+    void redo();
+
     void freezeForward();
     void freezeBackward();
     void freezeRange();
@@ -142,6 +170,15 @@ public slots:
     void saveProject();
     void saveProjectAs();
 
+    void exportTimecodes();
+
+    void autosave();
+    void autosaveFinished();
+    void removeAutosave(const QString &path); // Of the project at path.
+
+    void frameDataFileToggled(bool checked);
+    void journalToggled(bool checked);
+
     void cropChanged(int value);
     void cropToggled(bool checked);
     void resizeChanged(int value);